@@ -4,20 +4,23 @@
 #ifndef VM_EMU_CLUSTER_MANAGER_H
 #define VM_EMU_CLUSTER_MANAGER_H
 
-#include <stack>
+#include <set>
 #include <mutex>
+#include <vector>
 #include "part.h"
 
 class ClusterManager {
 public:
     explicit ClusterManager(ClusterNo numOfClusters);
     bool takeCluster(ClusterNo &out_cluster);
+    bool takeClusters(ClusterNo count, ClusterNo &out_first);
     void freeCluster(ClusterNo cluster);
+    void freeClusters(const std::vector<ClusterNo> &clusters);
 
 private:
     ClusterNo numOfClusters_;
     ClusterNo nextUnusedCluster_;
-    std::stack<ClusterNo> freedClusters_;
+    std::set<ClusterNo> freedClusters_; // ordered, so that runs of consecutive clusters can be found
     std::mutex cluster_guard_;
 
 };
@@ -0,0 +1,22 @@
+// File: CowPageDescr.h
+// Summary: CowPageDescr struct definition.
+
+#ifndef VM_EMU_COW_PAGE_DESCR_H
+#define VM_EMU_COW_PAGE_DESCR_H
+
+#include <vector>
+#include "descr.h"
+
+class KernelProcess;
+
+// A page that cloned processes share copy-on-write. The descriptors of the
+// processes hold the access rights and the index of the page; the frame or
+// cluster of the page is held here, once. It is released when the last
+// process lets go of the page, so processes_ is the reference count.
+struct CowPageDescr {
+    CowPageDescr(const PmtEntry1 &state);
+    PmtEntry1 state_; // DESC_BIT_WRITE is never set, writes have to fault
+    std::vector<KernelProcess *> processes_;
+};
+
+#endif // VM_EMU_COW_PAGE_DESCR_H
@@ -0,0 +1,16 @@
+// File: Extent.h
+// Summary: Extent struct definition.
+
+#ifndef VM_EMU_EXTENT_H
+#define VM_EMU_EXTENT_H
+
+#include "vm_declarations.h"
+
+// physically contiguous piece of a virtual address range
+struct Extent {
+    Extent(PhysicalAddress address, unsigned long length);
+    PhysicalAddress address_;
+    unsigned long length_;
+};
+
+#endif // VM_EMU_EXTENT_H
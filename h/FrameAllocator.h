@@ -6,6 +6,7 @@
 
 #include "vm_declarations.h"
 #include <mutex>
+#include <vector>
 
 // for testing purposes
 #include <iostream>
@@ -17,6 +18,7 @@ public:
 
     PhysicalAddress alloc();
     void dealloc(PhysicalAddress framePhysicalAddress);
+    void dealloc(std::vector<PhysicalAddress> &frames);
     FrameNum freeFramesCount();
     FrameNum getFrameSpaceSize() const;
     bool isFree(FrameNum frameNum);
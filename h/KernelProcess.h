@@ -6,13 +6,15 @@
 
 #include <vector>
 #include <mutex>
-#include <stack>
+#include <future>
+#include <atomic>
 #include <string>
-#include <unordered_map>
 #include "vm_declarations.h"
 #include "descr.h"
 #include "SegmentDescr.h"
 #include "SharedSegmentDescr.h"
+#include "Extent.h"
+#include "Tlb.h"
 
 // for testing purposes
 #include <iostream>
@@ -20,6 +22,16 @@
 
 class KernelSystem;
 
+// page number that stands for no page
+#define NO_PAGE ((PageNum)-1)
+
+// number of pages read() and write() fault in at once
+#define COPY_BATCH_PAGES 8
+
+// number of times getPhysicalAddress() reads in a page that got swapped out
+// after access() before it gives up
+#define PHYSICAL_ADDRESS_MAX_FAULTS 2
+
 class KernelProcess {
 public:
     KernelProcess(ProcessId pid, PmtEntry0 *pmt0, KernelSystem *system);
@@ -30,42 +42,118 @@ public:
     Status loadSegment(VirtualAddress startAddress, PageNum segmentSize, AccessType flags, void *content);
     Status deleteSegment(VirtualAddress startAddress);
     PhysicalAddress getPhysicalAddress(VirtualAddress address);
+    Status translate(VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress);
+    Status read(VirtualAddress address, void *buffer, unsigned long length);
+    Status write(VirtualAddress address, const void *buffer, unsigned long length);
+    Status translateRange(VirtualAddress address, unsigned long length, AccessType type, std::vector<Extent> &out_extents);
+    Status releaseRange(const std::vector<Extent> &extents);
     Status pageFault(VirtualAddress startAddress);
+    Status pageFaults(const VirtualAddress *addresses, unsigned int count);
+    std::future<Status> pageFaultAsync(VirtualAddress startAddress);
     KernelProcess *clone(ProcessId pid);
     KernelProcess *clone();
     Status createSharedSegment(VirtualAddress startAddress, PageNum segmentSize, const char *name, AccessType flags);
     Status disconnectSharedSegment(const char *name);
     Status deleteSharedSegment(const char *name);
 
+    // load control
+    void setPriority(unsigned int priority);
+    unsigned int getPriority() const;
+    unsigned long getPageFaultRate() const;
+    bool isSuspended() const;
+    PageNum getFrameQuota() const;
+    PageNum getResidentSetSize() const;
+
     // for testing purposes
+    void getTlbStatistics(unsigned long &hits, unsigned long &misses) const;
     friend std::ostream &operator<<(std::ostream &os, const KernelProcess &kp);
 private:
     friend class KernelSystem;
 
+    // frames and clusters to give back to the allocators at once
+    struct ReleasedResources {
+        std::vector<PhysicalAddress> frames_;
+        std::vector<ClusterNo> clusters_;
+        std::vector<PhysicalAddress> pmtFrames_;
+    };
+
     // page replacement
-    static PmtEntry1 *clockHand;
-    static PmtEntry1 *getVictim();
+    PmtEntry1 *getVictim();
+    PmtEntry1 *getLocalVictim();
+    PmtEntry1 *getOverQuotaVictim();
+    void addToClock(PmtEntry1 *descr);
+    void removeFromClock(PmtEntry1 *descr);
+    bool isInClock(PmtEntry1 *descr) const;
+    static bool isPageDirty(PmtEntry1 *descr);
+    bool isPagePinned(PmtEntry1 *descr) const;
+    bool pinPage(VirtualAddress address, AccessType type, PhysicalAddress pa, bool untilRelease);
+    bool isPageInFrame(VirtualAddress address, AccessType type, FrameNum frame) const;
+    bool setReferenceBit(PmtEntry1 *descr);
+    void clearReferenceBit(PmtEntry1 *descr);
+    void shootdown(PmtEntry1 *descr, FrameNum frame);
+    bool evictPage(PmtEntry1 *victim, const ClusterNo *reservedCluster = nullptr);
+    PhysicalAddress reclaimFrames(unsigned int count);
+    void swapOut();
+    void loadControl();
+    Status faultIn(VirtualAddress startAddress, std::unique_lock<std::mutex> &memoryLock);
+    PhysicalAddress takeFrame();
+    void addResidentPage(int pmt0Entry, int pmt1Entry, FrameNum frame);
+
+    // copy-on-write clone support
+    unsigned int makeCopyOnWrite(int pmt0Entry, int pmt1Entry);
+    Status copyOnWrite(int pmt0Entry, int pmt1Entry);
+    void releaseCowPage(unsigned int cowPage);
+    void releaseCowPage(unsigned int cowPage, ReleasedResources &released);
+    void shareTable(int pmt0Entry, KernelProcess *clone);
+    Status unshareTable(int pmt0Entry);
+    void leaveTable(int pmt0Entry);
 
     // shared segment support
-    static std::stack<unsigned int> usedSharedSegmentIds;
-    static unsigned int nextUnusedSharedSegmentId;
-    static std::unordered_map<std::string, SharedSegmentDescr *> sharedSegments;
-    static SharedSegmentDescr *findSharedSegmentById(unsigned int id);
+    SharedSegmentDescr *findSharedSegmentById(unsigned int id) const;
+    unsigned int sharedSegmentId(int pmt0Entry, const PmtEntry1 *descr) const;
+    PmtEntry1 *sharedDescriptor(int pmt0Entry, const PmtEntry1 *descr) const;
+    PmtEntry1 *stateDescriptor(int pmt0Entry, PmtEntry1 *descr) const;
 
     const ProcessId pid_;
     KernelSystem *system_;
     PmtEntry0 *pmt0_;
+    Pmt1Summary pmt1Summary_[PMT_0_NUM_ENTRIES];
     std::vector<SegmentDescr> segments_;
     std::mutex mutex_guard_;
+    Tlb tlb_;
+    std::atomic<unsigned int> references_; // see KernelSystem::ProcessReference
+    unsigned int pins_; // pins taken with translateRange() and not released yet, under memory_guard_
+
+    // load control
+    std::atomic<unsigned int> priority_;
+    std::atomic<bool> suspended_;
+    std::atomic<unsigned long> faultsInPeriod_;
+    std::atomic<unsigned long> faultRate_;
+    PageNum lastFaultPage_; // NO_PAGE before the first fault
 
+    // page fault frequency frame quota
+    std::atomic<PageNum> quota_;
+    std::atomic<PageNum> residentCount_; // private pages in memory
+    PageNum localClockHand_;
+
+    PmtEntry1 *pmt1Table(int pmt0Entry) const;
+    static bool isAccessAllowed(unsigned int descrFlags, AccessType type);
+    Status copy(VirtualAddress address, char *buffer, unsigned long length, AccessType type);
     Status validateSegmentInfo(VirtualAddress startAddr, PageNum segmentSize, AccessType flags);
     Status addSegment(VirtualAddress startAddr, PageNum segmentSize, AccessType flags);
     Status addSharedSegment(VirtualAddress startAddr, PageNum segmentSize, const char *name, AccessType flags);
     Status connectToSharedSegment(SharedSegmentDescr *descr);
     Status removeSegment(VirtualAddress startAddr);
-    Status initPmt1Entries(const SegmentDescr &segmDescr, unsigned int sharedSegmentId);
+    Status leaveSharedSegment(const char *name);
+    Status initPmt1Entries(const SegmentDescr &segmDescr, SharedSegmentDescr *sharedSegment);
     Status releasePmt1Entries(const SegmentDescr &segmDescr, bool releaseResources);
     bool invalidateEntries(int pmt0Entry, int pmt1StartEntry, int pmt1EndEntry, bool releaseResources);
+
+    // process exit
+    void teardown();
+    void collectPage(PmtEntry1 *page, ReleasedResources &released);
+    void resetFrame(FrameNum frame);
+    void returnResources(ReleasedResources &released);
 };
 
 #endif // VM_EMU_KERNEL_PROCESS_H
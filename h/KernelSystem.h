@@ -5,15 +5,78 @@
 #define VM_EMU_KERNEL_SYSTEM_H
 
 #include <stack>
+#include <deque>
 #include <mutex>
-#include <unordered_map>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
 #include "vm_declarations.h"
 #include "FrameAllocator.h"
 #include "ClusterManager.h"
+#include "ProcessTable.h"
+#include "CowPageDescr.h"
+#include "SharedSegmentRegistry.h"
+#include "PageFaultQueue.h"
 
 class Partition;
 class KernelProcess;
 struct PmtEntry0;
+struct PmtEntry1;
+
+// frame that is not in the page replacement list
+#define CLOCK_NO_FRAME ((FrameNum)-1)
+
+// time between two periodic jobs in microseconds
+#define PERIODIC_JOB_PERIOD 10000
+
+// Load control: the page fault rate is measured as the number of pages
+// faulted in during one period, in percents of the number of frames.
+// Above the high watermark the system is thrashing and processes get
+// suspended one per period; below the low watermark they get resumed.
+#define LOAD_CONTROL_HIGH_WATERMARK 100
+#define LOAD_CONTROL_LOW_WATERMARK 25
+
+// Page fault frequency: the faults of a process in one period are taken in
+// percents of its frame quota. Every period, the quota of a process above
+// PFF_UPPER_BOUND grows by PFF_QUOTA_STEP frames (as long as the quotas of
+// the running processes fit in memory), and the quota of a process below
+// PFF_LOWER_BOUND shrinks by the same step, never below PFF_MIN_QUOTA.
+// When memory is full, a process at its quota replaces its own pages, and
+// a process below it takes frames of suspended and over-quota processes
+// first.
+#define PFF_UPPER_BOUND 50
+#define PFF_LOWER_BOUND 10
+#define PFF_QUOTA_STEP 4
+#define PFF_MIN_QUOTA 4
+
+// Number of times the page faults of a batch of translations are serviced
+// before giving up; pages faulted in later in a round may evict the ones
+// faulted in earlier if the batch does not fit in memory.
+#define TRANSLATE_BATCH_MAX_ROUNDS 2
+
+// Upper limit for the number of frames reclaimed at once when memory is full.
+// The batch doubles with every replacement and halves every period in which
+// the page fault rate stays under LOAD_CONTROL_LOW_WATERMARK.
+#define RECLAIM_BATCH_MAX 8
+
+// Locking: locks are taken in the order below, never the other way around.
+// - KernelSystem::mutex_guard_: pids, load control and the process list.
+//   Processes are not torn down while it is held.
+// - KernelProcess::mutex_guard_: the segments and the private page tables
+//   of one process. Page faults of different processes do not contend
+//   on it.
+// - KernelSystem::memory_guard_: state shared between processes: frame
+//   tables, the page replacement list, copy-on-write pages and tables,
+//   shared segments, and descriptors of other processes reached through
+//   them (a page fault may evict a page of any process). It is released
+//   while a page is read from the swap partition; the page is marked with
+//   DESC_BIT_TRANSIT meanwhile and other faults on it wait on transitDone_.
+// - FrameAllocator and ClusterManager locks, held inside their methods.
+// translate() runs without locks, like the hardware it stands for, and
+// takes memory_guard_ only to resolve shared pages on a TLB miss. It walks
+// the page tables in a read section of the process table, so a Level 1 PMT
+// that is unlinked is freed only once no walk can reach it, see
+// reclaimPmtFrames().
 
 class KernelSystem {
 public:
@@ -26,23 +89,84 @@ public:
     KernelProcess *cloneProcess(ProcessId pid);
     Time periodicJob();
     Status access(ProcessId pid, VirtualAddress address, AccessType type); // hardware job
+    Status translate(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress);
+    Status translateAndResolve(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress);
+    Status translateBatch(ProcessId pid, const VirtualAddress *addresses, const AccessType *types, unsigned int count,
+        PhysicalAddress *out_physicalAddresses, Status *out_statuses);
+
+    // load control
+    bool isThrashing();
+    unsigned long getPageFaultRate();
 
 private:
     friend class KernelProcess;
 
+    // Keeps the process found by pid from being torn down until the end of
+    // the scope. Calls by pid that service page faults take one instead of
+    // staying in a read section, a page fault may wait for mutex_guard_ (see
+    // waitIfSuspended()) while a writer of the process table holds it.
+    class ProcessReference {
+    public:
+        ProcessReference(KernelSystem &system, ProcessId pid);
+        ~ProcessReference();
+        KernelProcess *get() const;
+    private:
+        KernelProcess *proc_;
+    };
+
     FrameAllocator processSpaceManager_;
     PhysicalAddress processSpace_;
     FrameAllocator pmtSpaceManager_;
+    PhysicalAddress pmtSpace_;
+    std::vector<unsigned int> pmtRefs_; // processes that use a shared or copy-on-write Level 1 PMT in the frame
+    std::vector<std::vector<KernelProcess *>> pmtProcesses_; // processes that use a copy-on-write Level 1 PMT in the frame
+    std::vector<unsigned int> pmtSharedSegments_; // shared segment the shared Level 1 PMT in the frame belongs to
+    std::vector<PhysicalAddress> retiredPmtFrames_; // unlinked Level 1 PMTs that translate() may still read
     ClusterManager diskSpaceManager_;
     Partition *swapPartition_;
+    std::vector<ClusterNo> frameClusters_; // backing cluster of a mapped page that is also swapped
+    std::vector<KernelProcess *> frameOwners_; // process a private page in the frame belongs to
+    std::vector<PageNum> framePages_; // page number of the page in the frame
+    std::vector<unsigned int> frameSharedIds_; // shared segment or copy-on-write page of a shared page in the frame
+    std::vector<std::atomic<unsigned int>> framePins_; // page in the frame cannot be evicted while pinned
+    std::vector<std::vector<KernelProcess *>> framePinners_; // processes that pinned the page with translateRange(), one entry per pin
+    std::deque<CowPageDescr> cowPages_; // grows at the back only, so the descriptors stay in place
+    std::stack<unsigned int> freeCowPages_;
+    std::vector<PmtEntry1 *> frameDescrs_; // descriptor of the page in the frame, the shared segment's for shared pages
+
+    // shared segments
+    SharedSegmentRegistry sharedSegments_;
+    std::stack<unsigned int> usedSharedSegmentIds_;
+    unsigned int nextUnusedSharedSegmentId_; // 0 is not a valid shared segment id
+
+    // page replacement list ("clock"), linked through frame numbers
+    std::vector<FrameNum> clockNext_; // CLOCK_NO_FRAME if the frame is not in the list
+    std::vector<FrameNum> clockPrev_;
+    FrameNum clockHand_;
+    std::atomic<unsigned int> reclaimBatch_;
     ProcessId nextUnusedPid_;
     std::stack<ProcessId> usedPids_;
-    std::unordered_map<ProcessId, KernelProcess *> pmtp_;
+    ProcessTable processTable_;
     std::mutex mutex_guard_;
+    std::mutex memory_guard_;
+    std::condition_variable transitDone_; // a page that was being read in is in memory
+
+    // load control
+    bool thrashing_;
+    unsigned long faultRate_;
+    std::condition_variable loadControl_;
+
+    // asynchronous page faults, last so that the workers stop first
+    PageFaultQueue pageFaults_;
 
     ProcessId getAvailablePid();
     void registerProcess(KernelProcess *proc);
     void unregisterProcess(KernelProcess *proc);
+    void reclaimPmtFrames();
+    void adaptFrameQuotas();
+    void suspendProcess();
+    void resumeProcess();
+    void waitIfSuspended(KernelProcess *proc);
 };
 
 #endif // VM_EMU_KERNEL_SYSTEM_H
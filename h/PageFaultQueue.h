@@ -0,0 +1,52 @@
+// File: PageFaultQueue.h
+// Summary: PageFaultQueue class header file.
+
+#ifndef VM_EMU_PAGE_FAULT_QUEUE_H
+#define VM_EMU_PAGE_FAULT_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "vm_declarations.h"
+
+class KernelProcess;
+
+// number of threads that service the asynchronous page faults of a system
+#define PAGE_FAULT_NUM_WORKERS 4
+
+// Asynchronous page faults of a system, serviced in order by a fixed number
+// of worker threads. The workers are started with the first fault, so a
+// system that never faults asynchronously runs no threads.
+class PageFaultQueue {
+public:
+    PageFaultQueue();
+    ~PageFaultQueue();
+
+    std::future<Status> push(KernelProcess *proc, VirtualAddress address);
+
+    // Faults of the process that were not started yet complete with TRAP,
+    // the ones being serviced are waited for.
+    void cancel(KernelProcess *proc);
+
+private:
+    struct Request {
+        KernelProcess *proc_;
+        VirtualAddress address_;
+        std::promise<Status> result_;
+    };
+
+    std::deque<Request> requests_;
+    std::vector<KernelProcess *> running_; // one entry per fault being serviced
+    std::vector<std::thread> workers_;
+    bool stopping_;
+    std::mutex guard_;
+    std::condition_variable queued_;
+    std::condition_variable done_;
+
+    void work();
+};
+
+#endif // VM_EMU_PAGE_FAULT_QUEUE_H
@@ -4,7 +4,10 @@
 #ifndef VM_EMU_PROCESS_H
 #define VM_EMU_PROCESS_H
 
+#include <vector>
+#include <future>
 #include "vm_declarations.h"
+#include "Extent.h"
 
 // for testing purposes
 #include <iostream>
@@ -25,13 +28,35 @@ public:
     Status pageFault(VirtualAddress startAddress);
     PhysicalAddress getPhysicalAddress(VirtualAddress address);
 
+    // Services the page fault on another thread, the future is ready when the page
+    // is in memory. Faults still queued when the process is deleted complete with TRAP.
+    std::future<Status> pageFaultAsync(VirtualAddress startAddress);
+
+    // copy length bytes from/to the virtual memory of the process, page faults are serviced on the way
+    Status read(VirtualAddress address, void *buffer, unsigned long length);
+    Status write(VirtualAddress address, const void *buffer, unsigned long length);
+
+    // Physical extents of a range of virtual memory, for I/O straight from/to frames.
+    // Pages of the range stay in memory until the extents are released.
+    Status translateRange(VirtualAddress address, unsigned long length, AccessType type, std::vector<Extent> &out_extents);
+    Status releaseRange(const std::vector<Extent> &extents);
+
     // support for shared segments
     Process *clone(ProcessId pid);
     Status createSharedSegment(VirtualAddress startAddress, PageNum segmentSize, const char *name, AccessType flags);
     Status disconnectSharedSegment(const char *name);
     Status deleteSharedSegment(const char *name);
 
+    // load control
+    void setPriority(unsigned int priority);
+    unsigned int getPriority() const;
+    unsigned long getPageFaultRate() const;
+    bool isSuspended() const;
+    PageNum getFrameQuota() const;
+    PageNum getResidentSetSize() const;
+
     // for testing purposes
+    void getTlbStatistics(unsigned long &hits, unsigned long &misses) const;
     friend std::ostream &operator<<(std::ostream &os, const Process &p);
 private:
     friend class System;
@@ -0,0 +1,83 @@
+// File: ProcessTable.h
+// Summary: ProcessTable class header file.
+
+#ifndef VM_EMU_PROCESS_TABLE_H
+#define VM_EMU_PROCESS_TABLE_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "vm_declarations.h"
+
+class KernelProcess;
+
+#define PROCESS_TABLE_INITIAL_CAPACITY 64
+
+// number of counters read sections are spread over, every thread always uses the same one
+#define PROCESS_TABLE_NUM_READER_SLOTS 16
+
+// Flat table of processes indexed by pid. Pids are recycled, so the table
+// stays dense.
+//
+// Lookups are wait-free and have to be done inside a read section; the
+// process found cannot be freed before the section ends. Reclamation is
+// epoch based: a read section counts itself in the counter of the current
+// epoch (even or odd), and synchronize() flips the epoch and waits for the
+// counters of the previous one to drain. A section that sees the epoch
+// change while it counts itself retries in the new one. Anything
+// unpublished before the flip is invisible to the sections that start
+// after it.
+class ProcessTable {
+public:
+    ProcessTable();
+    ~ProcessTable();
+
+    class ReadSection {
+    public:
+        explicit ReadSection(const ProcessTable &table);
+        ~ReadSection();
+    private:
+        const ProcessTable &table_;
+        unsigned int slot_;
+        unsigned int epoch_;
+    };
+
+    KernelProcess *lookup(ProcessId pid) const;
+
+    // Writers are serialized. remove() only unpublishes the process, it can
+    // be freed after a call to synchronize(). insert() does not wait for the
+    // readers, a table it replaces on growth is freed by the next
+    // synchronize().
+    void insert(ProcessId pid, KernelProcess *proc);
+    void remove(ProcessId pid);
+    void synchronize();
+
+    // processes in the table at the time of the call
+    std::vector<KernelProcess *> snapshot() const;
+
+private:
+    struct Slots {
+        explicit Slots(ProcessId capacity);
+        ~Slots();
+
+        ProcessId capacity_;
+        std::atomic<KernelProcess *> *entries_;
+    };
+
+    // keeps counters of different slots in different cache lines
+    struct ReaderSlot {
+        std::atomic<unsigned long> active_[2];
+        char padding_[64 - 2 * sizeof(std::atomic<unsigned long>)];
+    };
+
+    std::atomic<Slots *> slots_;
+    std::vector<Slots *> retired_; // replaced tables, under writer_guard_
+    mutable ReaderSlot readers_[PROCESS_TABLE_NUM_READER_SLOTS];
+    std::atomic<unsigned int> epoch_;
+    std::mutex writer_guard_;
+    std::mutex epoch_guard_;
+
+    static unsigned int readerSlot();
+};
+
+#endif // VM_EMU_PROCESS_TABLE_H
@@ -7,17 +7,25 @@
 #include <string>
 #include <vector>
 #include "vm_declarations.h"
+#include "descr.h"
 
 class KernelProcess;
 
 struct SharedSegmentDescr {
     SharedSegmentDescr(VirtualAddress va, PageNum size, unsigned int id, const char *name, AccessType rights);
+    unsigned int *sharedPmt1(unsigned int pmt0Entry);
     unsigned int id_;
     std::string name_;
     VirtualAddress startAddr_;
     PageNum size_;
     AccessType rights_;
     std::vector<KernelProcess *> processes_;
+    bool dying_; // being deleted, no process may connect
+    std::vector<PmtEntry1> pages_; // state of the pages, the same for all processes
+
+    // Level 1 PMTs covered completely by the segment, shared by the processes
+    unsigned int firstSharedPmt0Entry_;
+    std::vector<unsigned int> sharedPmt1s_; // PMT1_NONE while no process is connected
 };
 
 #endif // VM_EMU_SHARED_SEGMENT_DESCR_H
@@ -0,0 +1,38 @@
+// File: SharedSegmentRegistry.h
+// Summary: SharedSegmentRegistry class header file.
+
+#ifndef VM_EMU_SHARED_SEGMENT_REGISTRY_H
+#define VM_EMU_SHARED_SEGMENT_REGISTRY_H
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "vm_declarations.h"
+
+struct SharedSegmentDescr;
+
+// Shared segments of the system, indexed three ways:
+//  - by id, a direct lookup for fault, reference and eviction handling;
+//  - by start address, ordered, for overlap checks of new segments;
+//  - by name, for creating, disconnecting and deleting segments.
+// Ids are recycled, so the id index stays dense.
+class SharedSegmentRegistry {
+public:
+    SharedSegmentRegistry();
+    ~SharedSegmentRegistry();
+
+    SharedSegmentDescr *findById(unsigned int id) const;
+    SharedSegmentDescr *findByName(const char *name) const;
+    bool overlaps(VirtualAddress startAddr, PageNum size) const;
+
+    void insert(SharedSegmentDescr *descr);
+    void remove(SharedSegmentDescr *descr);
+
+private:
+    std::vector<SharedSegmentDescr *> byId_;
+    std::map<VirtualAddress, SharedSegmentDescr *> byAddress_;
+    std::unordered_map<std::string, unsigned int> byName_;
+};
+
+#endif // VM_EMU_SHARED_SEGMENT_REGISTRY_H
@@ -19,12 +19,35 @@ public:
     ~System();
 
     Process *createProcess();
+
+    // Load control runs here (see KernelSystem.h): the private pages of a
+    // suspended process are swapped out, without waiting for the process.
+    // A page referenced since the previous call is kept until the next one,
+    // so load control takes no page whose physical address was obtained
+    // after the previous call. A client that holds physical addresses across
+    // two calls has to pin the pages with Process::translateRange().
     Time periodicJob();
     Process *cloneProcess(ProcessId pid);
 
     // Hardware job
     Status access(ProcessId pid, VirtualAddress address, AccessType type);
 
+    // access() and getPhysicalAddress() in one go, the second one also
+    // services the page fault instead of returning PAGE_FAULT
+    Status translate(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress);
+    Status translateAndResolve(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress);
+
+    // Translates count references at once, servicing their page faults in
+    // a batch. Every reference gets its own status; references that could
+    // not be brought in together with the rest of the batch are left with
+    // PAGE_FAULT. Returns OK only if all of them were translated.
+    Status translateBatch(ProcessId pid, const VirtualAddress *addresses, const AccessType *types, unsigned int count,
+        PhysicalAddress *out_physicalAddresses, Status *out_statuses);
+
+    // load control
+    bool isThrashing();
+    unsigned long getPageFaultRate();
+
 private:
     friend class Process;
     friend class KernelProcess;
@@ -0,0 +1,66 @@
+// File: Tlb.h
+// Summary: Tlb class header file.
+
+#ifndef VM_EMU_TLB_H
+#define VM_EMU_TLB_H
+
+#include <atomic>
+#include "vm_declarations.h"
+
+// Software TLB - direct-mapped cache of page translations of one process.
+// Lookups are lock-free. Every entry is packed into a single 64-bit word:
+//
+// -----------------------------------------------------------------------------
+// |             frame              |          page          |      flags      |
+// -----------------------------------------------------------------------------
+//              32 bits                       24 bits               8 bits
+//
+// A word without TLB_BIT_VALID holds a stamp instead of a translation, see
+// reserve(). Stamps are never reused.
+//
+#define TLB_NUM_ENTRIES 64
+
+#define TLB_BIT_VALID       0x01    // is this entry valid (1) or not (0)
+#define TLB_BIT_READ        0x02    // read permission bit
+#define TLB_BIT_WRITE       0x04    // write permission bit
+#define TLB_BIT_EXEC        0x08    // execute permission bit
+#define TLB_BIT_DIRTY       0x10    // dirty bit is already set in the descriptor
+#define TLB_BIT_REFERENCE   0x20    // reference bit is already set in the descriptor
+
+class Tlb {
+public:
+    typedef unsigned long long Entry;
+
+    Tlb();
+
+    // Returns true if there is an entry for the page with all required flags set.
+    bool lookup(PageNum page, unsigned int requiredFlags, FrameNum &out_frame);
+
+    // A translation is inserted in two steps: reserve() puts a new stamp in
+    // the slot of the page before the page tables are read, and insert()
+    // replaces that stamp with the entry in one atomic operation. Every
+    // invalidation puts a new stamp in the slot, so a translation that was
+    // read from the page tables before the page got evicted is never seen
+    // by a lookup.
+    Entry reserve(PageNum page);
+    void insert(PageNum page, FrameNum frame, unsigned int flags, Entry stamp);
+    void invalidate(PageNum page);
+    void flush();
+
+    static unsigned int flagsFromDescriptor(unsigned int descrFlags);
+    static unsigned int flagsRequiredFor(AccessType type);
+
+    // for testing purposes
+    unsigned long getHits() const;
+    unsigned long getMisses() const;
+
+private:
+    std::atomic<Entry> entries_[TLB_NUM_ENTRIES];
+    std::atomic<Entry> nextStamp_;
+    std::atomic<unsigned long> hits_;
+    std::atomic<unsigned long> misses_;
+
+    Entry newStamp();
+};
+
+#endif // VM_EMU_TLB_H
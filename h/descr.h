@@ -15,19 +15,23 @@
 #include "vm_declarations.h"
 #include "part.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 // PmtEntry1 - Level 1 PMT Entry
-// Level 1 PMT Entry size: 16 bytes
+// Level 1 PMT Entry size: 8 bytes
 // alignof(PmtEntry1) == 4
 // One Level 1 PMT consists of 2^6 = 64 entries
-// Level 1 PMT size: 2^6 * 16B = 1KB = 1 page
+// Level 1 PMT size: 2^6 * 8B = 512B = 1/2 page
+// Descriptors hold no pointers, so the size is the same on 32-bit and
+// 64-bit hosts. The page replacement list is kept by the system, per frame.
 //
 #define PMT_1_NUM_ENTRIES 64
 
 struct PmtEntry1 {
     unsigned int flags;                    // various flags - 4 bytes
-    unsigned int location;                 // page physical location - either #frame or #cluster
-    PmtEntry1 *next;                       // address of the next valid descriptor
-    PmtEntry1 *prev;                       // address of the previous valid descriptor
+    unsigned int location;                 // page physical location - either #frame or #cluster, or shared segment id - 4 bytes
 };
 
 // PmtEntry0 - Level 0 PMT Entry
@@ -39,9 +43,80 @@ struct PmtEntry1 {
 #define PMT_0_NUM_ENTRIES 256
 
 struct PmtEntry0 {
-    PmtEntry1 *pmt1;                       // Level 1 PMT address for this entry - 4 bytes
+    unsigned int pmt1;                     // Level 1 PMT for this entry, PMT1_NONE if there is none - 4 bytes
 };
 
+static_assert(sizeof(PmtEntry1) == 8, "Level 1 PMT entry has to be 8 bytes");
+static_assert(sizeof(PmtEntry0) == 4, "Level 0 PMT entry has to be 4 bytes");
+static_assert(PMT_1_NUM_ENTRIES * sizeof(PmtEntry1) <= FRAME_SIZE, "Level 1 PMT has to fit in a frame");
+static_assert(PMT_0_NUM_ENTRIES * sizeof(PmtEntry0) <= FRAME_SIZE, "Level 0 PMT has to fit in a frame");
+
+// A Level 1 PMT is referred to by its frame number in the PMT space, plus one.
+// Level 1 PMTs that a shared segment covers completely are shared by all the
+// processes connected to the segment, and marked so in the Level 0 PMT entry.
+// Level 1 PMTs of a cloned process are shared with the clone copy-on-write
+// until either process changes the table, see KernelProcess::unshareTable().
+#define PMT1_NONE 0
+#define PMT0_BIT_SHARED 0x80000000
+#define PMT0_BIT_COW 0x40000000
+#define PMT1_IS_SHARED(pmt1) (((pmt1) & PMT0_BIT_SHARED) != 0)
+#define PMT1_IS_COW(pmt1) (((pmt1) & PMT0_BIT_COW) != 0)
+#define PMT1_FRAME(pmt1) (((pmt1) & ~(PMT0_BIT_SHARED | PMT0_BIT_COW)) - 1)
+#define PMT1_ADDRESS(pmtSpace, pmt1) ((PmtEntry1 *)((char *)(pmtSpace) + PMT1_FRAME(pmt1) * FRAME_SIZE))
+#define PMT1_REFERENCE(pmtSpace, address) ((unsigned int)(((char *)(address) - (char *)(pmtSpace)) / FRAME_SIZE + 1))
+
+// Level 0 PMT entries are changed under mutex_guard_ of the process, but
+// translate() walks the tables without a lock. It loads an entry once with
+// PMT0_LOAD() and uses only that value; a table is filled in before
+// PMT0_STORE() links it. An unlinked table is freed only after the walks
+// that may still reach it are done, see KernelSystem::reclaimPmtFrames().
+#ifdef _MSC_VER
+#define PMT0_LOAD(pmt1) (*(volatile unsigned int *)&(pmt1))
+#define PMT0_STORE(pmt1, value) (*(volatile unsigned int *)&(pmt1) = (value))
+#else
+#define PMT0_LOAD(pmt1) (__atomic_load_n(&(pmt1), __ATOMIC_ACQUIRE))
+#define PMT0_STORE(pmt1, value) (__atomic_store_n(&(pmt1), (value), __ATOMIC_RELEASE))
+#endif
+
+// Pmt1Summary - Level 1 PMT summary
+// Bit i of a mask stands for entry i of the table, so a scan over a table
+// tests all 64 entries at once. A table takes up a whole frame, so summaries
+// are kept by the process, one per Level 0 PMT entry.
+//
+struct Pmt1Summary {
+    unsigned long long valid;              // entries with DESC_BIT_VALID set
+    unsigned long long mapped;             // entries with DESC_BIT_MAPPED set
+};
+
+#define PMT1_ENTRY_MASK(entry) (1ULL << (entry))
+#define PMT1_RANGE_MASK(first, last) ((~0ULL >> (PMT_1_NUM_ENTRIES - 1 - (last))) & (~0ULL << (first)))
+
+// number of set bits in the mask
+inline int maskPopCount(unsigned long long mask)
+{
+#ifdef _MSC_VER
+    return __popcnt((unsigned int)mask) + __popcnt((unsigned int)(mask >> 32));
+#else
+    return __builtin_popcountll(mask);
+#endif
+}
+
+// index of the lowest set bit, the mask must not be 0
+inline int maskLowestBit(unsigned long long mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    if (_BitScanForward(&index, (unsigned long)mask))
+    {
+        return (int)index;
+    }
+    _BitScanForward(&index, (unsigned long)(mask >> 32));
+    return (int)index + 32;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
 #define DESC_BIT_MAPPED      0x00000001    // is page mapped to a frame (1) or not (0)
 #define DESC_BIT_DIRTY       0x00000002    // is frame dirty (1) or not (0)
 #define DESC_BIT_REFERENCE   0x00000004    // page reference bit
@@ -50,26 +125,51 @@ struct PmtEntry0 {
 #define DESC_BIT_EXEC        0x00000020    // execute permission bit
 #define DESC_BIT_SWAPPED     0x00000040    // is the frame swapped out (1) or not (0)
 #define DESC_BIT_VALID       0x00000080    // is this pmt1 entry valid (1) or not (0)
-
-#define FLAG_BITS_NUM 8
-
+#define DESC_BIT_SHARED      0x00000100    // is the page in a shared segment (1) or private (0)
+#define DESC_BIT_COW         0x00000200    // is the page shared copy-on-write with cloned processes (1) or not (0)
+#define DESC_BIT_TRANSIT     0x00000400    // is the page being read in from the swap partition (1) or not (0)
+
+#define FLAG_BITS_NUM 11
+
+// translate() sets the reference and dirty bits without a lock, while the
+// other bits of the same flags are changed under memory_guard_ of the system.
+// Bits are set and cleared with atomic read-modify-write operations, so that
+// no update is lost, and read with FLAGS_LOAD(), also under memory_guard_.
+// Whole flags in a table translate() can reach are written with FLAGS_STORE().
+// Relaxed ordering is enough, the flags publish no other data. Descriptors
+// stay plain structs, Level 1 PMTs are still copied with memcpy.
 #define BIT_IS_SET(flags, mask) ((flags) & (mask))
-#define BIT_SET(flags, mask) ((flags) |= (mask))
-#define BIT_CLEAR(flags, mask) ((flags) &= ~(mask))
+#ifdef _MSC_VER
+#define BIT_SET(flags, mask) (_InterlockedOr((volatile long *)&(flags), (long)(mask)))
+#define BIT_CLEAR(flags, mask) (_InterlockedAnd((volatile long *)&(flags), ~(long)(mask)))
+#define FLAGS_LOAD(flags) (*(volatile unsigned int *)&(flags))
+#define FLAGS_STORE(flags, value) (*(volatile unsigned int *)&(flags) = (value))
+#else
+#define BIT_SET(flags, mask) (__atomic_fetch_or(&(flags), (mask), __ATOMIC_RELAXED))
+#define BIT_CLEAR(flags, mask) (__atomic_fetch_and(&(flags), ~(mask), __ATOMIC_RELAXED))
+#define FLAGS_LOAD(flags) (__atomic_load_n(&(flags), __ATOMIC_RELAXED))
+#define FLAGS_STORE(flags, value) (__atomic_store_n(&(flags), (value), __ATOMIC_RELAXED))
+#endif
+
+// translate() reads the frame of a mapped page before it checks, with the
+// atomic bit set, that the page is still mapped, so the location fields of
+// the tables are written the same way.
+#define LOCATION_LOAD(location) FLAGS_LOAD(location)
+#define LOCATION_STORE(location, value) FLAGS_STORE(location, value)
 
 // shared segment support
-#define SHARED_PAGE_ID_MASK 0x00003fff
-#define SET_SHARED_PAGE_ID(flags, id) ((flags) |= (id << FLAG_BITS_NUM))
-#define SHARED_PAGE_ID(flags) (((flags) >> FLAG_BITS_NUM) & SHARED_PAGE_ID_MASK)
-
-#define SHARED_PAGE_ID_BITS_NUM 14
-
-#define SHARED_SEGMENT_ID_MASK 0x000003ff
-#define SHARED_SEGMENT_ID_LIMIT 1024 // 2^10
-#define ASSIGN_SHARED_SEGMENT(flags, id) ((flags) |= (id << (FLAG_BITS_NUM + SHARED_PAGE_ID_BITS_NUM)))
-#define SHARED_SEGMENT_ID(flags) (((flags) >> (FLAG_BITS_NUM + SHARED_PAGE_ID_BITS_NUM)) & SHARED_SEGMENT_ID_MASK)
-
-#define SHARED_SEGMENT_ID_BITS_NUM 10
+// A descriptor of a shared page in a private Level 1 PMT holds no state, so
+// its location field holds the id of the segment instead. The page itself is
+// identified by its virtual address. A descriptor in a shared Level 1 PMT is
+// the state of the page; the segment is known from the table, see
+// KernelSystem::pmtSharedSegments_.
+// A copy-on-write page is described the same way, with the index of the page
+// in KernelSystem::cowPages_ in place of the segment id.
+// Pages of both kinds are shared; the state of a private page is in the
+// descriptor, so telling them apart is one test on the access path.
+#define IS_SHARED_PAGE(flags) (BIT_IS_SET(flags, DESC_BIT_SHARED | DESC_BIT_COW) != 0)
+#define IS_COW_PAGE(flags) (BIT_IS_SET(flags, DESC_BIT_COW) != 0)
+#define SHARED_SEGMENT_ID_LIMIT 0xffffffff // 0 is not used
 
 #endif // VM_EMU_DESCR_H
 
@@ -15,8 +15,8 @@ bool ClusterManager::takeCluster(ClusterNo &out_cluster)
 
     if (!freedClusters_.empty())
     {
-        out_cluster = freedClusters_.top();
-        freedClusters_.pop();
+        out_cluster = *freedClusters_.begin();
+        freedClusters_.erase(freedClusters_.begin());
         return true;
     }
     if (nextUnusedCluster_ < numOfClusters_)
@@ -27,9 +27,54 @@ bool ClusterManager::takeCluster(ClusterNo &out_cluster)
     return false; // no free clusters
 }
 
+// Takes a run of count consecutive clusters.
+bool ClusterManager::takeClusters(ClusterNo count, ClusterNo &out_first)
+{
+    std::lock_guard<std::mutex> lock(cluster_guard_);
+
+    if (count == 0)
+    {
+        return false;
+    }
+
+    // try the part of the partition that was never used first
+    if (numOfClusters_ - nextUnusedCluster_ >= count)
+    {
+        out_first = nextUnusedCluster_;
+        nextUnusedCluster_ += count;
+        return true;
+    }
+
+    // look for a run among freed clusters
+    ClusterNo runLength = 0;
+    auto runStart = freedClusters_.begin();
+    for (auto it = freedClusters_.begin(); it != freedClusters_.end(); ++it)
+    {
+        if (runLength == 0 || *it != *runStart + runLength)
+        {
+            runStart = it;
+            runLength = 0;
+        }
+        if (++runLength == count)
+        {
+            out_first = *runStart;
+            freedClusters_.erase(runStart, ++it);
+            return true;
+        }
+    }
+
+    return false; // no run of free clusters that long
+}
+
 void ClusterManager::freeCluster(ClusterNo cluster)
 {
     std::lock_guard<std::mutex> lock(cluster_guard_);
-    freedClusters_.push(cluster);
+    freedClusters_.insert(cluster);
+}
+
+void ClusterManager::freeClusters(const std::vector<ClusterNo> &clusters)
+{
+    std::lock_guard<std::mutex> lock(cluster_guard_);
+    freedClusters_.insert(clusters.begin(), clusters.end());
 }
 
@@ -0,0 +1,10 @@
+// File: CowPageDescr.cpp
+// Summary: CowPageDescr struct implementation.
+
+#include "CowPageDescr.h"
+
+CowPageDescr::CowPageDescr(const PmtEntry1 &state):
+    state_(state), processes_()
+{
+
+}
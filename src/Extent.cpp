@@ -0,0 +1,10 @@
+// File: Extent.cpp
+// Summary: Extent struct implementation.
+
+#include "Extent.h"
+
+Extent::Extent(PhysicalAddress address, unsigned long length) :
+    address_(address), length_(length)
+{
+
+}
@@ -1,12 +1,13 @@
 // File: FrameAllocator.cpp
 // Summary: FrameAllocator class implementation file.
 
+#include <algorithm>
 #include "FrameAllocator.h"
 
 FrameAllocator::FrameAllocator(PhysicalAddress startAddress, PageNum size):
     freeSegmentHead_((FreeSegment *)startAddress),
-    frameSpaceStartAddress_((FrameAddress)startAddress), frameSpaceSize_(size),
-    freeFramesCount_(size), alloc_guard_()
+    freeFramesCount_(size), frameSpaceStartAddress_((FrameAddress)startAddress),
+    frameSpaceSize_(size), alloc_guard_()
 {
     freeSegmentHead_->next = nullptr;
     freeSegmentHead_->size = size;
@@ -81,6 +82,61 @@ void FrameAllocator::dealloc(PhysicalAddress framePhysicalAddress)
     ++freeFramesCount_;
 }
 
+// Frees many frames in one pass over the free list, under one lock.
+// Sorts the frames.
+void FrameAllocator::dealloc(std::vector<PhysicalAddress> &frames)
+{
+    std::sort(frames.begin(), frames.end());
+
+    std::lock_guard<std::mutex> lock(alloc_guard_);
+
+    FreeSegment *current = freeSegmentHead_;
+    FreeSegment *prev = nullptr;
+    for (PhysicalAddress framePhysicalAddress : frames)
+    {
+        FrameAddress frameAddress = (FrameAddress)framePhysicalAddress;
+        while (current && (FrameAddress)current < frameAddress)
+        {
+            prev = current;
+            current = current->next;
+        }
+
+        if ((prev && (FrameAddress)prev + prev->size > frameAddress)
+            || (current && (FrameAddress)current == frameAddress))
+        {
+            // frame already free
+            continue;
+        }
+
+        if (prev && (FrameAddress)prev + prev->size == frameAddress)
+        {
+            ++prev->size;
+        }
+        else
+        {
+            FreeSegment *newSegment = (FreeSegment *)frameAddress;
+            newSegment->size = 1;
+            newSegment->next = current;
+            if (prev)
+            {
+                prev->next = newSegment;
+            }
+            else
+            {
+                freeSegmentHead_ = newSegment;
+            }
+            prev = newSegment;
+        }
+
+        if (tryMerge(prev, current))
+        {
+            current = prev->next;
+        }
+
+        ++freeFramesCount_;
+    }
+}
+
 FrameNum FrameAllocator::freeFramesCount()
 {
     std::lock_guard<std::mutex> lock(alloc_guard_);
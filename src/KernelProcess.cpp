@@ -7,19 +7,12 @@
 #include "KernelProcess.h"
 #include "KernelSystem.h"
 
-// init. clockHand for the "clock algorithm" for page replacement
-PmtEntry1 *KernelProcess::clockHand = nullptr;
-
-std::stack<unsigned int> KernelProcess::usedSharedSegmentIds;
-
-// 0 is not a valid shared segment id
-unsigned int KernelProcess::nextUnusedSharedSegmentId = 1;
-
-std::unordered_map<std::string, SharedSegmentDescr *> KernelProcess::sharedSegments;
-
 KernelProcess::KernelProcess(ProcessId pid, PmtEntry0 *pmt0, KernelSystem *system):
-    pid_(pid), pmt0_(pmt0), system_(system), segments_()
+    pid_(pid), system_(system), pmt0_(pmt0), segments_(), references_(0), pins_(0),
+    priority_(0), suspended_(false), faultsInPeriod_(0), faultRate_(0), lastFaultPage_(NO_PAGE),
+    quota_(PFF_MIN_QUOTA), residentCount_(0), localClockHand_(0)
 {
+    memset(pmt1Summary_, 0, sizeof(pmt1Summary_));
     if (system_)
     {
         system_->registerProcess(this);
@@ -28,13 +21,11 @@ KernelProcess::KernelProcess(ProcessId pid, PmtEntry0 *pmt0, KernelSystem *syste
 
 KernelProcess::~KernelProcess()
 {
-    for (auto it = segments_.begin(); it != segments_.end(); ++it)
-    {
-        deleteSegment((*it).startAddr_);
-    }
+    // no access() can reach the process after this
     if (system_)
     {
         system_->unregisterProcess(this);
+        teardown();
     }
 }
 
@@ -43,6 +34,36 @@ ProcessId KernelProcess::getProcessId() const
     return pid_;
 }
 
+void KernelProcess::setPriority(unsigned int priority)
+{
+    priority_ = priority;
+}
+
+unsigned int KernelProcess::getPriority() const
+{
+    return priority_;
+}
+
+unsigned long KernelProcess::getPageFaultRate() const
+{
+    return faultRate_;
+}
+
+bool KernelProcess::isSuspended() const
+{
+    return suspended_;
+}
+
+PageNum KernelProcess::getFrameQuota() const
+{
+    return quota_;
+}
+
+PageNum KernelProcess::getResidentSetSize() const
+{
+    return residentCount_;
+}
+
 Status KernelProcess::createSegment(VirtualAddress startAddress,
                                     PageNum segmentSize, AccessType flags)
 {
@@ -98,8 +119,8 @@ Status KernelProcess::loadSegment(VirtualAddress startAddress,
     VirtualAddress addr = startAddress;
     for (auto it = clustersTaken.begin(); it != clustersTaken.end(); ++it, addr += PAGE_SIZE)
     {
-        PmtEntry1 *descr = pmt0_[VADDR_PMT0_ENTRY(addr)].pmt1 + VADDR_PMT1_ENTRY(addr);
-        descr->location = *it;
+        PmtEntry1 *descr = pmt1Table(VADDR_PMT0_ENTRY(addr)) + VADDR_PMT1_ENTRY(addr);
+        LOCATION_STORE(descr->location, *it);
         BIT_SET(descr->flags, DESC_BIT_SWAPPED);
     }
 
@@ -113,239 +134,1039 @@ Status KernelProcess::deleteSegment(VirtualAddress startAddress)
         return TRAP;
     }
 
-    return removeSegment(startAddress);
+    // the tables of the segment are freed once the locks are released
+    Status status = removeSegment(startAddress);
+    system_->reclaimPmtFrames();
+    return status;
 }
 
+// Enhanced second chance (NRU over reference and dirty bits):
+// the first lap looks for a page that is neither referenced nor dirty,
+// without touching any bits; the second lap looks for a page that is not
+// referenced but dirty, clearing reference bits along the way.
+// After the second lap every reference bit is cleared, so the next pair
+// of laps is guaranteed to find a victim. Pinned pages are skipped; if
+// every page is pinned there is no victim.
 PmtEntry1 *KernelProcess::getVictim()
 {
-    if (KernelProcess::clockHand == nullptr)
+    FrameNum &hand = system_->clockHand_;
+    if (hand == CLOCK_NO_FRAME)
     {
         return nullptr;
     }
 
-    while (BIT_IS_SET(KernelProcess::clockHand->flags, DESC_BIT_REFERENCE))
+    PmtEntry1 *ret = nullptr;
+    while (ret == nullptr)
     {
-        if (SHARED_SEGMENT_ID(KernelProcess::clockHand->flags) == 0)
+        // lap 1: (reference, dirty) == (0, 0)
+        FrameNum start = hand;
+        do
+        {
+            PmtEntry1 *descr = system_->frameDescrs_[hand];
+            if (!isPagePinned(descr)
+                && !BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_REFERENCE)
+                && !isPageDirty(descr))
+            {
+                ret = descr;
+                break;
+            }
+            hand = system_->clockNext_[hand];
+        } while (hand != start);
+
+        if (ret)
         {
-            BIT_CLEAR(KernelProcess::clockHand->flags, DESC_BIT_REFERENCE);
-            KernelProcess::clockHand = KernelProcess::clockHand->next;
+            break;
         }
-        else // page belongs to a shared segment
+
+        // lap 2: (reference, dirty) == (0, 1), give referenced pages a second chance
+        bool unpinned = false;
+        do
         {
-            VirtualAddress startAddress = SHARED_PAGE_ID(KernelProcess::clockHand->flags) << BITS_IN_VADDR_OFFSET;
-            int pmt0Entry = VADDR_PMT0_ENTRY(startAddress);
-            int pmt1Entry = VADDR_PMT1_ENTRY(startAddress);
-            SharedSegmentDescr *sd = findSharedSegmentById(SHARED_SEGMENT_ID(KernelProcess::clockHand->flags));
-            for (auto it : sd->processes_)
+            PmtEntry1 *descr = system_->frameDescrs_[hand];
+            if (!isPagePinned(descr))
             {
-                BIT_CLEAR(it->pmt0_[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_REFERENCE);
+                unpinned = true;
+                if (!BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_REFERENCE))
+                {
+                    ret = descr;
+                    break;
+                }
+                clearReferenceBit(descr);
             }
+            hand = system_->clockNext_[hand];
+        } while (hand != start);
+
+        if (!unpinned)
+        {
+            return nullptr;
         }
     }
 
-    PmtEntry1 *ret = KernelProcess::clockHand;
-    if (KernelProcess::clockHand == KernelProcess::clockHand->next)
+    removeFromClock(ret);
+    return ret;
+}
+
+// A private page of another process that is suspended or holds more frames
+// than its quota, found in one lap of the global clock. Unreferenced pages
+// are preferred.
+PmtEntry1 *KernelProcess::getOverQuotaVictim()
+{
+    FrameNum hand = system_->clockHand_;
+    if (hand == CLOCK_NO_FRAME)
     {
-        KernelProcess::clockHand = nullptr;
+        return nullptr;
     }
-    else
+
+    PmtEntry1 *ret = nullptr;
+    FrameNum start = hand;
+    do
     {
-        KernelProcess::clockHand = KernelProcess::clockHand->next;
-        ret->prev->next = ret->next;
-        ret->next->prev = ret->prev;
-    }
+        KernelProcess *owner = system_->frameOwners_[hand];
+        PmtEntry1 *descr = system_->frameDescrs_[hand];
+        if (owner && owner != this && !isPagePinned(descr)
+            && (owner->suspended_ || owner->residentCount_ > owner->quota_))
+        {
+            if (!BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_REFERENCE))
+            {
+                ret = descr;
+                break;
+            }
+            if (!ret)
+            {
+                ret = descr;
+            }
+        }
+        hand = system_->clockNext_[hand];
+    } while (hand != start);
 
-    ret->next = nullptr;
-    ret->prev = nullptr;
+    if (ret)
+    {
+        removeFromClock(ret);
+    }
     return ret;
 }
 
-SharedSegmentDescr *KernelProcess::findSharedSegmentById(unsigned int id)
+// Local replacement for a process at its frame quota: the same enhanced
+// second chance as getVictim, over the private pages of this process only.
+// Laps alternate between (reference, dirty) == (0, 0) and (0, 1).
+// Only the mapped pages are visited, found through the summaries of the
+// level 1 tables.
+PmtEntry1 *KernelProcess::getLocalVictim()
 {
-    auto it = std::find_if(
-        KernelProcess::sharedSegments.begin(),
-        KernelProcess::sharedSegments.end(),
-        [id](std::pair<std::string, SharedSegmentDescr *> e) { return e.second->id_ == id;  }
-    );
-    if (it == KernelProcess::sharedSegments.end())
+    const PageNum pages = PMT_0_NUM_ENTRIES * PMT_1_NUM_ENTRIES;
+    int handTable = localClockHand_ / PMT_1_NUM_ENTRIES;
+    int handEntry = localClockHand_ % PMT_1_NUM_ENTRIES;
+
+    for (int lap = 0; lap < 4; ++lap)
     {
-        return nullptr;
+        bool takeDirty = lap % 2 == 1;
+
+        // the table the hand points into is visited twice: first from the hand on, at the end up to the hand
+        for (int t = 0; t <= PMT_0_NUM_ENTRIES; ++t)
+        {
+            int table = (handTable + t) % PMT_0_NUM_ENTRIES;
+            unsigned long long candidates = pmt1Summary_[table].mapped;
+            if (t == 0)
+            {
+                candidates &= ~0ULL << handEntry;
+            }
+            else if (t == PMT_0_NUM_ENTRIES)
+            {
+                candidates &= ~(~0ULL << handEntry);
+            }
+
+            while (candidates)
+            {
+                int entry = maskLowestBit(candidates);
+                candidates &= candidates - 1;
+
+                PmtEntry1 *descr = pmt1Table(table) + entry;
+                if (IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)) || !isInClock(descr) || isPagePinned(descr))
+                {
+                    continue;
+                }
+
+                PageNum page = table * PMT_1_NUM_ENTRIES + entry;
+                unsigned int flags = FLAGS_LOAD(descr->flags);
+                if (!BIT_IS_SET(flags, DESC_BIT_REFERENCE)
+                    && (takeDirty || !BIT_IS_SET(flags, DESC_BIT_DIRTY)))
+                {
+                    localClockHand_ = (page + 1) % pages;
+                    removeFromClock(descr);
+                    return descr;
+                }
+                if (takeDirty)
+                {
+                    BIT_CLEAR(descr->flags, DESC_BIT_REFERENCE);
+                    tlb_.invalidate(page);
+                }
+            }
+        }
     }
 
-    return it->second;
+    return nullptr;
 }
 
-// Note: It is assmed that access() method of KernelSystem is called before a call to this method
-// and returned PAGE_FAULT.
-Status KernelProcess::pageFault(VirtualAddress startAddress)
+// The page replacement list links the frames of mapped pages, so the
+// descriptor has to be mapped when it is added to or removed from the list.
+void KernelProcess::addToClock(PmtEntry1 *descr)
 {
-    std::lock_guard<std::mutex> lock(mutex_guard_);
+    FrameNum frame = descr->location;
+    std::vector<FrameNum> &next = system_->clockNext_;
+    std::vector<FrameNum> &prev = system_->clockPrev_;
+    FrameNum &hand = system_->clockHand_;
 
-    int pmt0Entry = VADDR_PMT0_ENTRY(startAddress);
-    int pmt1Entry = VADDR_PMT1_ENTRY(startAddress);
-    PmtEntry1 *descr = pmt0_[pmt0Entry].pmt1 + pmt1Entry;
-    PhysicalAddress frameAddress = system_->processSpaceManager_.alloc();
-    bool sharedPage = false;
-    SharedSegmentDescr *ssd = nullptr;
+    system_->frameDescrs_[frame] = descr;
+    if (hand == CLOCK_NO_FRAME)
+    {
+        hand = frame;
+        next[frame] = prev[frame] = frame;
+    }
+    else
+    {
+        prev[frame] = prev[hand];
+        next[frame] = hand;
+        next[prev[hand]] = frame;
+        prev[hand] = frame;
+    }
+}
 
-    if (SHARED_SEGMENT_ID(descr->flags) != 0)
+void KernelProcess::removeFromClock(PmtEntry1 *descr)
+{
+    FrameNum frame = descr->location;
+    std::vector<FrameNum> &next = system_->clockNext_;
+    std::vector<FrameNum> &prev = system_->clockPrev_;
+    FrameNum &hand = system_->clockHand_;
+
+    if (frame == hand)
     {
-        sharedPage = true;
-        ssd = findSharedSegmentById(SHARED_SEGMENT_ID(descr->flags));
-        if (ssd == nullptr)
+        hand = next[frame];
+        if (frame == hand)
         {
-            return TRAP;
+            hand = CLOCK_NO_FRAME;
         }
     }
+    next[prev[frame]] = next[frame];
+    prev[next[frame]] = prev[frame];
+    next[frame] = prev[frame] = CLOCK_NO_FRAME;
+    system_->frameDescrs_[frame] = nullptr;
+}
 
-    if (frameAddress) // new free frame, no page replacement
+// A shared page is in the list through the descriptor of one of the
+// processes, see invalidateEntries().
+bool KernelProcess::isInClock(PmtEntry1 *descr) const
+{
+    return BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED) && system_->clockNext_[descr->location] != CLOCK_NO_FRAME;
+}
+
+// Note: The caller has to make sure that the level 1 PMT exists.
+PmtEntry1 *KernelProcess::pmt1Table(int pmt0Entry) const
+{
+    return PMT1_ADDRESS(system_->pmtSpace_, PMT0_LOAD(pmt0_[pmt0Entry].pmt1));
+}
+
+// Note: The caller has to hold memory_guard_, pins are taken under it.
+bool KernelProcess::isPagePinned(PmtEntry1 *descr) const
+{
+    return system_->framePins_[descr->location] > 0;
+}
+
+// The reference and dirty bits of a shared page are kept in a single place,
+// the descriptor of the shared segment, see sharedDescriptor(). The methods
+// below expect that descriptor for shared pages.
+bool KernelProcess::isPageDirty(PmtEntry1 *descr)
+{
+    return BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_DIRTY) != 0;
+}
+
+// Returns false if the page was no longer mapped when the bit was set.
+bool KernelProcess::setReferenceBit(PmtEntry1 *descr)
+{
+    return BIT_IS_SET(BIT_SET(descr->flags, DESC_BIT_REFERENCE), DESC_BIT_MAPPED) != 0;
+}
+
+// Note: TLB entries cache the reference bit, so they have to be shot down.
+void KernelProcess::clearReferenceBit(PmtEntry1 *descr)
+{
+    BIT_CLEAR(descr->flags, DESC_BIT_REFERENCE);
+    shootdown(descr, descr->location);
+}
+
+// Removes the translation of a page in the frame from the TLBs of all
+// processes that map it. Has to be called after the descriptor is changed,
+// see Tlb::reserve().
+void KernelProcess::shootdown(PmtEntry1 *descr, FrameNum frame)
+{
+    PageNum page = system_->framePages_[frame];
+    if (!IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)))
     {
-        FrameNum frame = ((char *)frameAddress - (char *)system_->processSpace_) / FRAME_SIZE;
-        if (BIT_IS_SET(descr->flags, DESC_BIT_SWAPPED))
+        KernelProcess *owner = system_->frameOwners_[frame];
+        if (owner)
         {
-            ClusterNo locationOnDisk = descr->location;
-            system_->swapPartition_->readCluster(locationOnDisk, (char *)frameAddress);
+            owner->tlb_.invalidate(page);
+            return;
         }
 
-        if (!sharedPage)
+        // a page of a copy-on-write table, cached by all the processes that use the table
+        FrameNum table = ((char *)descr - (char *)system_->pmtSpace_) / FRAME_SIZE;
+        for (auto it : system_->pmtProcesses_[table])
         {
-            descr->location = frame;
+            it->tlb_.invalidate(page);
         }
-        else
+        return;
+    }
+
+    unsigned int id = system_->frameSharedIds_[frame];
+    const std::vector<KernelProcess *> &processes = IS_COW_PAGE(FLAGS_LOAD(descr->flags))
+        ? system_->cowPages_[id].processes_
+        : findSharedSegmentById(id)->processes_;
+    for (auto it : processes)
+    {
+        it->tlb_.invalidate(page);
+    }
+}
+
+SharedSegmentDescr *KernelProcess::findSharedSegmentById(unsigned int id) const
+{
+    return system_->sharedSegments_.findById(id);
+}
+
+// Returns the id of the shared segment of a shared page.
+unsigned int KernelProcess::sharedSegmentId(int pmt0Entry, const PmtEntry1 *descr) const
+{
+    unsigned int pmt1 = PMT0_LOAD(pmt0_[pmt0Entry].pmt1);
+    if (PMT1_IS_SHARED(pmt1))
+    {
+        return system_->pmtSharedSegments_[PMT1_FRAME(pmt1)];
+    }
+
+    return descr->location;
+}
+
+// The descriptors of a shared page in the page tables of the processes only
+// identify the segment and hold the access rights. Whether the page is
+// mapped, where it is, and its reference and dirty bits are kept by the
+// shared segment, so a fault, an eviction or a reference updates one
+// descriptor no matter how many processes share the page.
+PmtEntry1 *KernelProcess::sharedDescriptor(int pmt0Entry, const PmtEntry1 *descr) const
+{
+    SharedSegmentDescr *ssd = findSharedSegmentById(descr->location);
+    if (ssd == nullptr)
+    {
+        return nullptr;
+    }
+
+    PageNum page = pmt0Entry * PMT_1_NUM_ENTRIES + (PageNum)(descr - pmt1Table(pmt0Entry));
+    return &ssd->pages_[page - (ssd->startAddr_ >> BITS_IN_VADDR_OFFSET)];
+}
+
+// Returns the descriptor that holds the state of the page. Pages in shared
+// Level 1 PMTs are described by the table itself, there is one for all the
+// processes.
+PmtEntry1 *KernelProcess::stateDescriptor(int pmt0Entry, PmtEntry1 *descr) const
+{
+    if (!IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)) || PMT1_IS_SHARED(PMT0_LOAD(pmt0_[pmt0Entry].pmt1)))
+    {
+        return descr;
+    }
+
+    if (IS_COW_PAGE(FLAGS_LOAD(descr->flags)))
+    {
+        return &system_->cowPages_[descr->location].state_;
+    }
+
+    return sharedDescriptor(pmt0Entry, descr);
+}
+
+// Writes the victim page back to disk if necessary and marks it as not mapped.
+// The frame itself is not released.
+// If the page needs a new cluster, reservedCluster is used when given.
+// Note: The victim has to be unlinked from the page replacement list before
+//       a call to this method.
+bool KernelProcess::evictPage(PmtEntry1 *victim, const ClusterNo *reservedCluster)
+{
+    FrameNum frame = victim->location;
+    PhysicalAddress frameAddress = (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE);
+
+    if (isPagePinned(victim)) // pinned after it was chosen
+    {
+        if (reservedCluster)
         {
-            for (auto it : ssd->processes_)
+            system_->diskSpaceManager_.freeCluster(*reservedCluster);
+        }
+        return false;
+    }
+
+    // The page is unmapped and dropped from the TLBs first, so that no new
+    // write can reach the frame. A write that got through before is seen in
+    // the dirty bit, which is read and cleared in one atomic operation.
+    BIT_CLEAR(victim->flags, DESC_BIT_MAPPED);
+    shootdown(victim, frame);
+    bool dirty = BIT_IS_SET(BIT_CLEAR(victim->flags, DESC_BIT_DIRTY), DESC_BIT_DIRTY) != 0;
+
+    // Victim page is written to disk only if it is dirty. A cluster is
+    // taken only if the page has no backing cluster on disk yet.
+    // A clean page just falls back to its backing cluster (if any).
+    ClusterNo victimCluster = 0;
+    bool victimOnDisk = BIT_IS_SET(FLAGS_LOAD(victim->flags), DESC_BIT_SWAPPED) != 0;
+    if (victimOnDisk)
+    {
+        victimCluster = system_->frameClusters_[frame];
+    }
+
+    if (dirty)
+    {
+        if (!victimOnDisk)
+        {
+            if (reservedCluster)
             {
-                it->pmt0_[pmt0Entry].pmt1[pmt1Entry].location = frame;
+                victimCluster = *reservedCluster;
+                reservedCluster = nullptr;
             }
+            else if (!system_->diskSpaceManager_.takeCluster(victimCluster))
+            {
+                // no space for swap, the page stays mapped
+                BIT_SET(victim->flags, DESC_BIT_MAPPED | DESC_BIT_DIRTY);
+                return false;
+            }
+            victimOnDisk = true;
         }
+        system_->swapPartition_->writeCluster(victimCluster, (const char *)frameAddress);
     }
-    else // page replacement
+
+    if (reservedCluster) // not needed after all
     {
-        ClusterNo freeCluster;
-        bool success = system_->diskSpaceManager_.takeCluster(freeCluster);
-        if (!success) // make sure cluster is available for POTENTIAL swap
+        system_->diskSpaceManager_.freeCluster(*reservedCluster);
+    }
+
+    // this entry is no longer mapped to frame
+    KernelProcess *owner = system_->frameOwners_[frame];
+    if (owner) // private page, not in a copy-on-write table
+    {
+        PageNum page = system_->framePages_[frame];
+        --owner->residentCount_;
+        owner->pmt1Summary_[page / PMT_1_NUM_ENTRIES].mapped &= ~PMT1_ENTRY_MASK(page % PMT_1_NUM_ENTRIES);
+    }
+    if (victimOnDisk)
+    {
+        LOCATION_STORE(victim->location, victimCluster);
+        BIT_SET(victim->flags, DESC_BIT_SWAPPED);
+    }
+
+    return true;
+}
+
+// Reclaims up to count frames from the global clock in one go. Dirty
+// victims without a backing cluster get a run of consecutive clusters and
+// the write-backs are issued in ascending cluster order, so the swap-out
+// is a single sequential pass over the partition. One reclaimed frame is
+// returned to the caller, the others go back to the free pool.
+PhysicalAddress KernelProcess::reclaimFrames(unsigned int count)
+{
+    struct Eviction {
+        PmtEntry1 *victim;
+        ClusterNo cluster;
+        bool newCluster;
+    };
+
+    std::vector<Eviction> evictions;
+    ClusterNo clustersNeeded = 0;
+    while (evictions.size() < count)
+    {
+        PmtEntry1 *victim = getVictim();
+        if (!victim)
         {
-            return TRAP;
+            break;
         }
 
-        PmtEntry1 *victim = KernelProcess::getVictim();
-        if (!victim)
+        Eviction e = { victim, 0, false };
+        if (BIT_IS_SET(FLAGS_LOAD(victim->flags), DESC_BIT_SWAPPED))
         {
-            system_->diskSpaceManager_.freeCluster(freeCluster);
-            return TRAP;
+            e.cluster = system_->frameClusters_[victim->location];
         }
-        FrameNum frame = victim->location;
+        else if (isPageDirty(victim))
+        {
+            e.newCluster = true;
+            ++clustersNeeded;
+        }
+        evictions.push_back(e);
+    }
+
+    ClusterNo nextCluster = 0;
+    bool run = clustersNeeded > 1 && system_->diskSpaceManager_.takeClusters(clustersNeeded, nextCluster);
+    if (run)
+    {
+        for (Eviction &e : evictions)
+        {
+            if (e.newCluster)
+            {
+                e.cluster = nextCluster++;
+            }
+        }
+        std::sort(evictions.begin(), evictions.end(),
+            [](const Eviction &e1, const Eviction &e2) { return e1.cluster < e2.cluster; });
+    }
+
+    PhysicalAddress ret = nullptr;
+    for (const Eviction &e : evictions)
+    {
+        FrameNum frame = e.victim->location;
         PhysicalAddress frameAddress = (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE);
+        if (!evictPage(e.victim, (run && e.newCluster) ? &e.cluster : nullptr))
+        {
+            // no space for swap, victim stays in memory
+            addToClock(e.victim);
+            continue;
+        }
 
-        bool victimPageShared = false;
-        SharedSegmentDescr *victimSsd = nullptr;
-        if (SHARED_SEGMENT_ID(victim->flags) != 0)
+        if (!ret)
+        {
+            ret = frameAddress;
+        }
+        else
         {
-            victimPageShared = true;
-            victimSsd = findSharedSegmentById(SHARED_SEGMENT_ID(victim->flags));
+            system_->processSpaceManager_.dealloc(frameAddress);
         }
+    }
+
+    return ret;
+}
+
+// Swaps out the private pages of the process that are in memory.
+// Pages of shared segments are left alone, other processes may use them,
+// and so are pinned pages. Called by the periodic job in every period
+// while the process is suspended. The page of the last fault is kept too,
+// the process may be just about to retry the access that faulted.
+// A page referenced since the previous pass may still be used through an
+// address the client got before the suspension; it gets a second chance
+// and goes on the next pass.
+void KernelProcess::swapOut()
+{
+    std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
 
-        // if necessary, swap out victim page
-        if (BIT_IS_SET(victim->flags, DESC_BIT_SWAPPED) || BIT_IS_SET(victim->flags, DESC_BIT_DIRTY))
+    for (int i = 0; i < PMT_0_NUM_ENTRIES; ++i)
+    {
+        unsigned long long mapped = pmt1Summary_[i].mapped;
+        while (mapped)
         {
-            if (!victimPageShared)
+            int j = maskLowestBit(mapped);
+            mapped &= mapped - 1;
+
+            PmtEntry1 *descr = pmt1Table(i) + j;
+            if (IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)) || isPagePinned(descr)
+                || (PageNum)(i * PMT_1_NUM_ENTRIES + j) == lastFaultPage_)
             {
-                victim->location = freeCluster;
-                BIT_CLEAR(victim->flags, DESC_BIT_DIRTY);
-                BIT_SET(victim->flags, DESC_BIT_SWAPPED);
+                continue;
             }
-            else // victim page belongs to a shared segment
+
+            // the page is unmapped before the reference bit is checked, see translate()
+            if (BIT_IS_SET(BIT_CLEAR(descr->flags, DESC_BIT_MAPPED), DESC_BIT_REFERENCE))
             {
-                VirtualAddress victimStartAddress = SHARED_PAGE_ID(victim->flags) << BITS_IN_VADDR_OFFSET;
-                int victimPmt0Entry = VADDR_PMT0_ENTRY(victimStartAddress);
-                int victimPmt1Entry = VADDR_PMT1_ENTRY(victimStartAddress);
-                for (auto it : victimSsd->processes_)
-                {
-                    it->pmt0_[victimPmt0Entry].pmt1[victimPmt1Entry].location = freeCluster;
-                    BIT_CLEAR(it->pmt0_[victimPmt0Entry].pmt1[victimPmt1Entry].flags, DESC_BIT_DIRTY);
-                    BIT_SET(it->pmt0_[victimPmt0Entry].pmt1[victimPmt1Entry].flags, DESC_BIT_SWAPPED);
+                BIT_SET(descr->flags, DESC_BIT_MAPPED);
+                clearReferenceBit(descr);
+                continue;
+            }
 
-                }
+            FrameNum frame = descr->location;
+            removeFromClock(descr);
+            if (!evictPage(descr))
+            {
+                // no space for swap, leave the rest in memory
+                addToClock(descr);
+                return;
             }
+            system_->processSpaceManager_.dealloc((PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE));
+        }
+    }
+}
+
+// Note: It is assmed that access() method of KernelSystem is called before a call to this method
+// and returned PAGE_FAULT.
+Status KernelProcess::pageFault(VirtualAddress startAddress)
+{
+    loadControl();
 
-            system_->swapPartition_->writeCluster(freeCluster, (const char *)frameAddress);
+    std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::unique_lock<std::mutex> memoryLock(system_->memory_guard_);
+    return faultIn(startAddress, memoryLock);
+}
+
+// Services the page faults of a batch of pages under a single lock. Pages
+// are expected to be sorted, so that pages swapped out together are read
+// in together.
+Status KernelProcess::pageFaults(const VirtualAddress *addresses, unsigned int count)
+{
+    loadControl();
+
+    std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::unique_lock<std::mutex> memoryLock(system_->memory_guard_);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (faultIn(addresses[i], memoryLock) != OK)
+        {
+            return TRAP;
+        }
+    }
+    return OK;
+}
+
+// The page fault is serviced by a worker thread of the system, so that the
+// caller can run other processes while the page is read in.
+std::future<Status> KernelProcess::pageFaultAsync(VirtualAddress startAddress)
+{
+    return system_->pageFaults_.push(this, startAddress);
+}
+
+// load control: a suspended process already gave up its resident set, it waits to be resumed
+void KernelProcess::loadControl()
+{
+    if (suspended_)
+    {
+        system_->waitIfSuspended(this);
+    }
+}
+
+// Note: The caller has to hold mutex_guard_ and memory_guard_ of the system
+//       through memoryLock.
+Status KernelProcess::faultIn(VirtualAddress startAddress, std::unique_lock<std::mutex> &memoryLock)
+{
+    int pmt0Entry = VADDR_PMT0_ENTRY(startAddress);
+    int pmt1Entry = VADDR_PMT1_ENTRY(startAddress);
+    PmtEntry1 *descr = pmt1Table(pmt0Entry) + pmt1Entry;
+    bool cowTable = PMT1_IS_COW(pmt0_[pmt0Entry].pmt1);
+    if (cowTable && BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_WRITE))
+    {
+        // the page may be written after the fault, the process needs a table
+        // of its own; a page that can not be written is loaded for all the
+        // processes that use the table
+        if (unshareTable(pmt0Entry) != OK)
+        {
+            return TRAP;
+        }
+        descr = pmt1Table(pmt0Entry) + pmt1Entry;
+        cowTable = false;
+    }
+
+    // a fault of another process is reading the page in, it is not read twice
+    PmtEntry1 *state;
+    while ((state = stateDescriptor(pmt0Entry, descr)) != nullptr && BIT_IS_SET(FLAGS_LOAD(state->flags), DESC_BIT_TRANSIT))
+    {
+        system_->transitDone_.wait(memoryLock);
+    }
+
+    if (IS_COW_PAGE(FLAGS_LOAD(descr->flags)) && BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_WRITE))
+    {
+        // the page is private after this, and in memory unless it was taken over from disk
+        if (copyOnWrite(pmt0Entry, pmt1Entry) != OK)
+        {
+            return TRAP;
+        }
+    }
+
+    bool sharedPage = IS_SHARED_PAGE(FLAGS_LOAD(descr->flags));
+    unsigned int sharedId = sharedPage ? sharedSegmentId(pmt0Entry, descr) : 0;
+    descr = stateDescriptor(pmt0Entry, descr);
+    if (descr == nullptr)
+    {
+        return TRAP;
+    }
+
+    if (BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED))
+    {
+        return OK; // already serviced
+    }
+
+    ++faultsInPeriod_;
+    lastFaultPage_ = startAddress >> BITS_IN_VADDR_OFFSET;
+
+    PhysicalAddress frameAddress = takeFrame();
+    if (!frameAddress)
+    {
+        return TRAP;
+    }
+    FrameNum frame = ((char *)frameAddress - (char *)system_->processSpace_) / FRAME_SIZE;
+
+    if (BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_SWAPPED))
+    {
+        ClusterNo locationOnDisk = descr->location;
+        if (sharedPage || !cowTable)
+        {
+            // The frame is in no list, and the descriptor stays in place
+            // while this process uses the page, so other page faults may go
+            // on during the read. Private pages of copy-on-write tables are
+            // read under the lock, other processes may copy their table.
+            BIT_SET(descr->flags, DESC_BIT_TRANSIT);
+            memoryLock.unlock();
+            system_->swapPartition_->readCluster(locationOnDisk, (char *)frameAddress);
+            memoryLock.lock();
+            BIT_CLEAR(descr->flags, DESC_BIT_TRANSIT);
+            system_->transitDone_.notify_all();
         }
         else
         {
-            system_->diskSpaceManager_.freeCluster(freeCluster);
+            system_->swapPartition_->readCluster(locationOnDisk, (char *)frameAddress);
         }
+        system_->frameClusters_[frame] = locationOnDisk; // keep the cluster as backing store
+    }
 
-        // this entry is no longer mapped to frame
-        if (!victimPageShared)
+    LOCATION_STORE(descr->location, frame);
+    BIT_SET(descr->flags, DESC_BIT_MAPPED);
+    BIT_SET(descr->flags, DESC_BIT_REFERENCE);
+    BIT_CLEAR(descr->flags, DESC_BIT_DIRTY);
+    if (!sharedPage && !cowTable)
+    {
+        addResidentPage(pmt0Entry, pmt1Entry, frame);
+    }
+    else if (!sharedPage)
+    {
+        system_->frameOwners_[frame] = nullptr; // like the other pages of the table
+        system_->framePages_[frame] = startAddress >> BITS_IN_VADDR_OFFSET;
+    }
+    else
+    {
+        system_->frameOwners_[frame] = nullptr; // shared pages do not count against quotas
+        system_->framePages_[frame] = startAddress >> BITS_IN_VADDR_OFFSET;
+        system_->frameSharedIds_[frame] = sharedId;
+    }
+
+    // link in the list for page replacement
+    addToClock(descr);
+
+    return OK;
+}
+
+// Returns a frame for a page that is faulted in: a free one, or one taken
+// from a victim page, nullptr if there is none.
+// Note: The caller has to hold mutex_guard_.
+PhysicalAddress KernelProcess::takeFrame()
+{
+    PhysicalAddress frameAddress = system_->processSpaceManager_.alloc();
+    if (frameAddress) // new free frame, no page replacement
+    {
+        return frameAddress;
+    }
+
+    // page replacement
+    PmtEntry1 *victim = nullptr;
+    if (residentCount_ >= quota_)
+    {
+        // process is at its frame quota, replace one of its own pages
+        victim = getLocalVictim();
+    }
+    else
+    {
+        // process is below its quota, take a frame from a process that does not need it first
+        victim = getOverQuotaVictim();
+    }
+
+    if (victim)
+    {
+        FrameNum frame = victim->location;
+        if (!evictPage(victim))
+        {
+            // no space for swap, victim stays in memory
+            addToClock(victim);
+            return nullptr;
+        }
+        return (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE);
+    }
+
+    // memory is still full, reclaim a bigger batch next time
+    unsigned int batch = system_->reclaimBatch_;
+    system_->reclaimBatch_ = std::min<unsigned int>(batch * 2, RECLAIM_BATCH_MAX);
+
+    return reclaimFrames(batch);
+}
+
+// Accounts for a private page of the process that was mapped to the frame.
+void KernelProcess::addResidentPage(int pmt0Entry, int pmt1Entry, FrameNum frame)
+{
+    pmt1Summary_[pmt0Entry].mapped |= PMT1_ENTRY_MASK(pmt1Entry);
+    system_->frameOwners_[frame] = this;
+    system_->framePages_[frame] = pmt0Entry * PMT_1_NUM_ENTRIES + pmt1Entry;
+    ++residentCount_;
+}
+
+// Turns a private page of the process, mapped or swapped, into a page shared
+// copy-on-write, with the processes that use its table as its only users so
+// far. The frame and the cluster of the page go to the shared descriptor,
+// nothing is copied.
+// Returns the index of the page in KernelSystem::cowPages_.
+// Note: The caller has to hold mutex_guard_.
+unsigned int KernelProcess::makeCopyOnWrite(int pmt0Entry, int pmt1Entry)
+{
+    PmtEntry1 *descr = pmt1Table(pmt0Entry) + pmt1Entry;
+    PmtEntry1 state;
+    state.flags = (FLAGS_LOAD(descr->flags) | DESC_BIT_COW) & ~DESC_BIT_WRITE;
+    state.location = descr->location;
+
+    unsigned int cowPage;
+    if (!system_->freeCowPages_.empty())
+    {
+        cowPage = system_->freeCowPages_.top();
+        system_->freeCowPages_.pop();
+        system_->cowPages_[cowPage].state_ = state;
+    }
+    else
+    {
+        cowPage = system_->cowPages_.size();
+        system_->cowPages_.emplace_back(state);
+    }
+    if (PMT1_IS_COW(pmt0_[pmt0Entry].pmt1))
+    {
+        system_->cowPages_[cowPage].processes_ = system_->pmtProcesses_[PMT1_FRAME(pmt0_[pmt0Entry].pmt1)];
+    }
+    else
+    {
+        system_->cowPages_[cowPage].processes_.push_back(this);
+    }
+
+    if (BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED))
+    {
+        FrameNum frame = descr->location;
+        if (isInClock(descr))
+        {
+            system_->frameDescrs_[frame] = &system_->cowPages_[cowPage].state_;
+        }
+        if (system_->frameOwners_[frame] == this) // pages of copy-on-write tables are not counted
         {
-            BIT_CLEAR(victim->flags, DESC_BIT_MAPPED);
+            system_->frameOwners_[frame] = nullptr;
+            pmt1Summary_[pmt0Entry].mapped &= ~PMT1_ENTRY_MASK(pmt1Entry);
+            --residentCount_;
         }
-        else // victim page belongs to a shared segment
+        system_->frameSharedIds_[frame] = cowPage;
+    }
+
+    // translate() may have set the dirty or reference bit since the state was taken
+    unsigned int flags = BIT_CLEAR(descr->flags, ~(DESC_BIT_VALID | DESC_BIT_READ | DESC_BIT_WRITE | DESC_BIT_EXEC));
+    BIT_SET(descr->flags, DESC_BIT_COW);
+    BIT_SET(system_->cowPages_[cowPage].state_.flags, flags & (DESC_BIT_DIRTY | DESC_BIT_REFERENCE));
+    LOCATION_STORE(descr->location, cowPage);
+
+    // the TLB may allow writes to the page
+    tlb_.invalidate(pmt0Entry * PMT_1_NUM_ENTRIES + pmt1Entry);
+    return cowPage;
+}
+
+// Services a fault on a writable copy-on-write page, a write or the first
+// touch of a page that is not in memory: the process gets its own copy of
+// the page in a new frame, and lets go of the shared one. The last process
+// to let go takes the page over as it is, in memory or not.
+// Note: The caller has to hold mutex_guard_.
+Status KernelProcess::copyOnWrite(int pmt0Entry, int pmt1Entry)
+{
+    PmtEntry1 *descr = pmt1Table(pmt0Entry) + pmt1Entry;
+    unsigned int cowPage = descr->location;
+    CowPageDescr &cow = system_->cowPages_[cowPage];
+    PmtEntry1 *state = &cow.state_;
+    unsigned int rights = FLAGS_LOAD(descr->flags) & ~DESC_BIT_COW;
+
+    if (cow.processes_.size() == 1)
+    {
+        const unsigned int stateBits = DESC_BIT_MAPPED | DESC_BIT_SWAPPED | DESC_BIT_DIRTY | DESC_BIT_REFERENCE;
+        bool inClock = isInClock(state);
+        FLAGS_STORE(descr->flags, rights | (FLAGS_LOAD(state->flags) & stateBits));
+        LOCATION_STORE(descr->location, state->location);
+        if (BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED))
         {
-            VirtualAddress victimStartAddress = SHARED_PAGE_ID(victim->flags) << BITS_IN_VADDR_OFFSET;
-            int victimPmt0Entry = VADDR_PMT0_ENTRY(victimStartAddress);
-            int victimPmt1Entry = VADDR_PMT1_ENTRY(victimStartAddress);
-            for (auto it : victimSsd->processes_)
+            if (inClock)
             {
-                BIT_CLEAR(it->pmt0_[victimPmt0Entry].pmt1[victimPmt1Entry].flags, DESC_BIT_MAPPED);
+                system_->frameDescrs_[descr->location] = descr;
             }
+            addResidentPage(pmt0Entry, pmt1Entry, descr->location);
         }
+        cow.processes_.clear();
+        system_->freeCowPages_.push(cowPage);
+    }
+    else
+    {
+        ++faultsInPeriod_;
 
-        if (BIT_IS_SET(descr->flags, DESC_BIT_SWAPPED))
+        // the page may be evicted to make room for the copy
+        PhysicalAddress frameAddress = takeFrame();
+        if (!frameAddress)
         {
-            ClusterNo locationOnDisk = descr->location;
-            system_->swapPartition_->readCluster(locationOnDisk, (char *)frameAddress);
+            return TRAP;
         }
 
-        if (!sharedPage)
+        if (BIT_IS_SET(FLAGS_LOAD(state->flags), DESC_BIT_MAPPED))
         {
-            descr->location = frame;
+            memcpy(frameAddress, (char *)system_->processSpace_ + state->location * FRAME_SIZE, PAGE_SIZE);
         }
-        else
+        else if (BIT_IS_SET(FLAGS_LOAD(state->flags), DESC_BIT_SWAPPED))
         {
-            for (auto it : ssd->processes_)
+            system_->swapPartition_->readCluster(state->location, (char *)frameAddress);
+        }
+        cow.processes_.erase(std::find(cow.processes_.begin(), cow.processes_.end(), this));
+
+        // the copy has no cluster yet, it has to be written when evicted
+        FrameNum frame = ((char *)frameAddress - (char *)system_->processSpace_) / FRAME_SIZE;
+        FLAGS_STORE(descr->flags, rights | DESC_BIT_MAPPED | DESC_BIT_REFERENCE | DESC_BIT_DIRTY);
+        LOCATION_STORE(descr->location, frame);
+        addResidentPage(pmt0Entry, pmt1Entry, frame);
+        addToClock(descr);
+    }
+
+    tlb_.invalidate(pmt0Entry * PMT_1_NUM_ENTRIES + pmt1Entry);
+    return OK;
+}
+
+// Makes the table of the entry a copy-on-write table shared with the clone.
+// Pages of the table that are in memory no longer count against the quota of
+// the process, like the pages of shared segments.
+// Note: The caller has to hold mutex_guard_, the table must not hold pages
+//       of shared segments.
+void KernelProcess::shareTable(int pmt0Entry, KernelProcess *clone)
+{
+    if (!PMT1_IS_COW(pmt0_[pmt0Entry].pmt1))
+    {
+        unsigned long long mapped = pmt1Summary_[pmt0Entry].mapped;
+        while (mapped)
+        {
+            int j = maskLowestBit(mapped);
+            mapped &= mapped - 1;
+            system_->frameOwners_[pmt1Table(pmt0Entry)[j].location] = nullptr;
+            --residentCount_;
+        }
+        pmt1Summary_[pmt0Entry].mapped = 0;
+
+        BIT_SET(pmt0_[pmt0Entry].pmt1, PMT0_BIT_COW);
+        FrameNum table = PMT1_FRAME(pmt0_[pmt0Entry].pmt1);
+        system_->pmtRefs_[table] = 1;
+        system_->pmtProcesses_[table].assign(1, this);
+    }
+
+    FrameNum table = PMT1_FRAME(pmt0_[pmt0Entry].pmt1);
+    ++system_->pmtRefs_[table];
+    system_->pmtProcesses_[table].push_back(clone);
+
+    // the clone uses the copy-on-write pages of the table as well
+    unsigned long long valid = pmt1Summary_[pmt0Entry].valid;
+    while (valid)
+    {
+        int j = maskLowestBit(valid);
+        valid &= valid - 1;
+        if (IS_COW_PAGE(FLAGS_LOAD(pmt1Table(pmt0Entry)[j].flags)))
+        {
+            system_->cowPages_[pmt1Table(pmt0Entry)[j].location].processes_.push_back(clone);
+        }
+    }
+
+    PMT0_STORE(clone->pmt0_[pmt0Entry].pmt1, pmt0_[pmt0Entry].pmt1);
+    clone->pmt1Summary_[pmt0Entry].valid = pmt1Summary_[pmt0Entry].valid;
+    clone->pmt1Summary_[pmt0Entry].mapped = 0;
+}
+
+// Gives the process a table of its own in place of a copy-on-write table.
+// Pages of the table that hold a frame or a cluster become copy-on-write
+// pages of all the processes that use the table, so the table and its copy
+// describe them the same way. The last process to use the table takes it
+// over as it is.
+// Note: The caller has to hold mutex_guard_.
+Status KernelProcess::unshareTable(int pmt0Entry)
+{
+    PmtEntry1 *pmt1 = pmt1Table(pmt0Entry);
+    FrameNum table = PMT1_FRAME(pmt0_[pmt0Entry].pmt1);
+
+    if (system_->pmtRefs_[table] == 1)
+    {
+        unsigned long long valid = pmt1Summary_[pmt0Entry].valid;
+        while (valid)
+        {
+            int j = maskLowestBit(valid);
+            valid &= valid - 1;
+            if (!IS_SHARED_PAGE(FLAGS_LOAD(pmt1[j].flags)) && BIT_IS_SET(FLAGS_LOAD(pmt1[j].flags), DESC_BIT_MAPPED))
             {
-                it->pmt0_[pmt0Entry].pmt1[pmt1Entry].location = frame;
+                addResidentPage(pmt0Entry, j, pmt1[j].location);
             }
         }
+
+        BIT_CLEAR(pmt0_[pmt0Entry].pmt1, PMT0_BIT_COW);
+        system_->pmtRefs_[table] = 0;
+        system_->pmtProcesses_[table].clear();
+        return OK;
     }
 
-    if (!sharedPage)
+    PmtEntry1 *copy = (PmtEntry1 *)system_->pmtSpaceManager_.alloc();
+    if (copy == nullptr)
     {
-        BIT_SET(descr->flags, DESC_BIT_MAPPED);
-        BIT_SET(descr->flags, DESC_BIT_REFERENCE);
-        BIT_CLEAR(descr->flags, DESC_BIT_DIRTY);
+        return TRAP;
     }
-    else
+
+    unsigned long long valid = pmt1Summary_[pmt0Entry].valid;
+    while (valid)
     {
-        for (auto it : ssd->processes_)
+        int j = maskLowestBit(valid);
+        valid &= valid - 1;
+        if (!IS_SHARED_PAGE(FLAGS_LOAD(pmt1[j].flags))
+            && (BIT_IS_SET(FLAGS_LOAD(pmt1[j].flags), DESC_BIT_MAPPED) || BIT_IS_SET(FLAGS_LOAD(pmt1[j].flags), DESC_BIT_SWAPPED)))
         {
-            BIT_SET(it->pmt0_[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_MAPPED);
-            BIT_SET(it->pmt0_[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_REFERENCE);
-            BIT_CLEAR(it->pmt0_[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_DIRTY);
+            makeCopyOnWrite(pmt0Entry, j);
         }
     }
+    memcpy(copy, pmt1, PMT_1_NUM_ENTRIES * sizeof(PmtEntry1));
 
-    // link in the list for page replacement
-    if (clockHand == nullptr)
+    std::vector<KernelProcess *> &processes = system_->pmtProcesses_[table];
+    processes.erase(std::find(processes.begin(), processes.end(), this));
+    --system_->pmtRefs_[table];
+    PMT0_STORE(pmt0_[pmt0Entry].pmt1, PMT1_REFERENCE(system_->pmtSpace_, copy));
+    return OK;
+}
+
+// Lets go of a copy-on-write table that other processes still use.
+// Note: The caller has to hold mutex_guard_.
+void KernelProcess::leaveTable(int pmt0Entry)
+{
+    FrameNum table = PMT1_FRAME(pmt0_[pmt0Entry].pmt1);
+    unsigned long long valid = pmt1Summary_[pmt0Entry].valid;
+    while (valid)
     {
-        clockHand = descr;
-        clockHand->next = clockHand->prev = clockHand;
+        int j = maskLowestBit(valid);
+        valid &= valid - 1;
+        if (IS_COW_PAGE(FLAGS_LOAD(pmt1Table(pmt0Entry)[j].flags)))
+        {
+            CowPageDescr &cow = system_->cowPages_[pmt1Table(pmt0Entry)[j].location];
+            cow.processes_.erase(std::find(cow.processes_.begin(), cow.processes_.end(), this));
+        }
+        tlb_.invalidate((pmt0Entry << BITS_IN_VADDR_PMT1_ENTRY) | j);
     }
-    else
+
+    std::vector<KernelProcess *> &processes = system_->pmtProcesses_[table];
+    processes.erase(std::find(processes.begin(), processes.end(), this));
+    --system_->pmtRefs_[table];
+    PMT0_STORE(pmt0_[pmt0Entry].pmt1, PMT1_NONE);
+    pmt1Summary_[pmt0Entry].valid = 0;
+    pmt1Summary_[pmt0Entry].mapped = 0;
+}
+
+// Lets go of a copy-on-write page. The last process to do so releases the
+// frame and the cluster of the page.
+// Note: The caller has to hold mutex_guard_.
+void KernelProcess::releaseCowPage(unsigned int cowPage)
+{
+    ReleasedResources released;
+    releaseCowPage(cowPage, released);
+    returnResources(released);
+}
+
+void KernelProcess::releaseCowPage(unsigned int cowPage, ReleasedResources &released)
+{
+    CowPageDescr &cow = system_->cowPages_[cowPage];
+    cow.processes_.erase(std::find(cow.processes_.begin(), cow.processes_.end(), this));
+    if (!cow.processes_.empty())
     {
-        descr->prev = clockHand->prev;
-        descr->next = clockHand;
-        clockHand->prev->next = descr;
-        clockHand->prev = descr;
+        return;
     }
 
-    return OK;
+    collectPage(&cow.state_, released);
+    system_->freeCowPages_.push(cowPage);
 }
 
 KernelProcess *KernelProcess::clone(ProcessId pid)
 {
     std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
 
     // allocate and initialize level 0 pmt for new process
     PmtEntry0 *pmt0 = (PmtEntry0 *)system_->pmtSpaceManager_.alloc();
@@ -356,48 +1177,94 @@ KernelProcess *KernelProcess::clone(ProcessId pid)
 
     for (int i = 0; i < PMT_0_NUM_ENTRIES; ++i)
     {
-        pmt0[i].pmt1 = nullptr;
+        pmt0[i].pmt1 = PMT1_NONE;
     }
 
-    // count how many pmt1 frames and cluster is needed for the new process
+    // Level 1 PMTs are shared with the new process copy-on-write, except for
+    // the ones that hold pages of shared segments or pinned pages; count how
+    // many pmt1 frames and pinned pages are needed for the tables that are copied
     int pmt1FramesToAlloc = 0;
-    int clustersToAlloc = 0;
+    int pagesToCopy = 0;
+    bool copyTable[PMT_0_NUM_ENTRIES] = { false };
     // also, remember all shared segments the original process is connected to
     std::vector<unsigned int> sharedSegmentIds;
     for (int i = 0; i < PMT_0_NUM_ENTRIES; ++i)
     {
-        if (pmt0_[i].pmt1)
+        if (pmt0_[i].pmt1 && !PMT1_IS_COW(pmt0_[i].pmt1))
         {
-            ++pmt1FramesToAlloc;
-            for (int j = 0; j < PMT_1_NUM_ENTRIES; ++j)
+            if (PMT1_IS_SHARED(pmt0_[i].pmt1))
             {
-                if (!BIT_IS_SET(pmt0_[i].pmt1[j].flags, DESC_BIT_VALID))
+                // the table is linked, not copied
+                unsigned int id = system_->pmtSharedSegments_[PMT1_FRAME(pmt0_[i].pmt1)];
+                if (std::find(sharedSegmentIds.begin(), sharedSegmentIds.end(), id) == sharedSegmentIds.end())
                 {
-                    continue;
+                    sharedSegmentIds.push_back(id);
                 }
+                continue;
+            }
+
+            int pinned = 0;
+            unsigned long long valid = pmt1Summary_[i].valid;
+            while (valid)
+            {
+                int j = maskLowestBit(valid);
+                valid &= valid - 1;
 
-                if (SHARED_SEGMENT_ID(pmt0_[i].pmt1[j].flags) > 0)
+                PmtEntry1 *descr = pmt1Table(i) + j;
+                if (IS_COW_PAGE(FLAGS_LOAD(descr->flags)))
+                {
+                    continue;
+                }
+                if (IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)))
                 {
                     // do not allocate a cluster, this is a descriptor for a shared page
-
-                    sharedSegmentIds.push_back(SHARED_SEGMENT_ID(pmt0_[i].pmt1[j].flags));
+                    unsigned int id = descr->location;
+                    if (std::find(sharedSegmentIds.begin(), sharedSegmentIds.end(), id) == sharedSegmentIds.end())
+                    {
+                        sharedSegmentIds.push_back(id);
+                    }
+                    copyTable[i] = true;
                 }
-                else if (BIT_IS_SET(pmt0_[i].pmt1[j].flags, DESC_BIT_MAPPED)
-                     || BIT_IS_SET(pmt0_[i].pmt1[j].flags, DESC_BIT_SWAPPED))
+                else if (BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED) && isPagePinned(descr))
                 {
-                    ++clustersToAlloc;
+                    // the frame of a pinned page may be written to at any time, it is copied now
+                    ++pinned;
+                    copyTable[i] = true;
                 }
             }
+
+            if (copyTable[i])
+            {
+                ++pmt1FramesToAlloc;
+                pagesToCopy += pinned;
+            }
+        }
+    }
+
+    // pinned pages are copied to free frames, no page is evicted for them;
+    // the ones that do not fit go through the swap partition
+    std::vector<PhysicalAddress> framesTaken;
+    for (int i = 0; i < pagesToCopy; ++i)
+    {
+        PhysicalAddress pa = system_->processSpaceManager_.alloc();
+        if (pa == nullptr)
+        {
+            break;
         }
+        framesTaken.push_back(pa);
     }
 
     std::vector<ClusterNo> clustersTaken;
-    for (int i = 0; i < clustersToAlloc; ++i)
+    for (int i = framesTaken.size(); i < pagesToCopy; ++i)
     {
         ClusterNo cluster;
         bool success = system_->diskSpaceManager_.takeCluster(cluster);
         if (!success) // not enough clusters on disk
         {
+            for (auto it = framesTaken.begin(); it != framesTaken.end(); ++it)
+            {
+                system_->processSpaceManager_.dealloc(*it);
+            }
             for (auto it = clustersTaken.begin(); it != clustersTaken.end(); ++it)
             {
                 system_->diskSpaceManager_.freeCluster(*it);
@@ -414,6 +1281,10 @@ KernelProcess *KernelProcess::clone(ProcessId pid)
         PhysicalAddress pa = system_->pmtSpaceManager_.alloc();
         if (pa == nullptr)
         {
+            for (auto it = framesTaken.begin(); it != framesTaken.end(); ++it)
+            {
+                system_->processSpaceManager_.dealloc(*it);
+            }
             for (auto it = clustersTaken.begin(); it != clustersTaken.end(); ++it)
             {
                 system_->diskSpaceManager_.freeCluster(*it);
@@ -428,66 +1299,107 @@ KernelProcess *KernelProcess::clone(ProcessId pid)
         pmt1FramesTaken.push_back(pa);
     }
 
+    KernelProcess *newProcess = new KernelProcess(pid, pmt0, system_);
+
     char buffer[PAGE_SIZE];
     auto frameIterator = pmt1FramesTaken.begin();
+    auto pageFrameIterator = framesTaken.begin();
     auto clusterIterator = clustersTaken.begin();
 
+    bool tablesShared = false;
     for (int i = 0; i < PMT_0_NUM_ENTRIES; ++i)
     {
-        if (pmt0_[i].pmt1)
+        newProcess->pmt1Summary_[i].valid = pmt1Summary_[i].valid;
+        if (PMT1_IS_SHARED(pmt0_[i].pmt1))
+        {
+            pmt0[i].pmt1 = pmt0_[i].pmt1;
+            ++system_->pmtRefs_[PMT1_FRAME(pmt0_[i].pmt1)];
+        }
+        else if (pmt0_[i].pmt1 && !copyTable[i])
         {
-            pmt0[i].pmt1 = (PmtEntry1 *)(*frameIterator);
+            shareTable(i, newProcess);
+            tablesShared = true;
+        }
+        else if (pmt0_[i].pmt1)
+        {
+            PmtEntry1 *newPmt1 = (PmtEntry1 *)(*frameIterator);
+            pmt0[i].pmt1 = PMT1_REFERENCE(system_->pmtSpace_, newPmt1);
             ++frameIterator;
+            memset(newPmt1, 0, PMT_1_NUM_ENTRIES * sizeof(PmtEntry1));
 
-            for (int j = 0; j < PMT_1_NUM_ENTRIES; ++j)
+            unsigned long long valid = pmt1Summary_[i].valid;
+            while (valid)
             {
-                pmt0[i].pmt1[j].flags = 0;
-                pmt0[i].pmt1[j].location = 0;
-                pmt0[i].pmt1[j].next = nullptr;
-                pmt0[i].pmt1[j].prev = nullptr;
+                int j = maskLowestBit(valid);
+                valid &= valid - 1;
 
-                if (!BIT_IS_SET(pmt0_[i].pmt1[j].flags, DESC_BIT_VALID))
+                PmtEntry1 *descr = pmt1Table(i) + j;
+                if (!IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)) && BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED) && isPagePinned(descr)
+                    && pageFrameIterator != framesTaken.end())
                 {
+                    // the copy has no cluster yet, it has to be written when evicted
+                    PhysicalAddress frameAddress = *pageFrameIterator;
+                    ++pageFrameIterator;
+                    FrameNum frame = ((char *)frameAddress - (char *)system_->processSpace_) / FRAME_SIZE;
+                    memcpy(frameAddress, (const char *)system_->processSpace_ + descr->location * FRAME_SIZE, PAGE_SIZE);
+
+                    newPmt1[j].flags = (FLAGS_LOAD(descr->flags) & ~DESC_BIT_SWAPPED) | DESC_BIT_REFERENCE | DESC_BIT_DIRTY;
+                    newPmt1[j].location = frame;
+                    newProcess->addResidentPage(i, j, frame);
+                    newProcess->addToClock(newPmt1 + j);
                     continue;
                 }
-
-                pmt0[i].pmt1[j].flags = pmt0_[i].pmt1[j].flags;
-
-                if (SHARED_SEGMENT_ID(pmt0_[i].pmt1[j].flags) > 0)
-                {
-                    pmt0[i].pmt1[j].location = pmt0_[i].pmt1[j].location;
-                }
-                else if (BIT_IS_SET(pmt0_[i].pmt1[j].flags, DESC_BIT_MAPPED)
-                     || BIT_IS_SET(pmt0_[i].pmt1[j].flags, DESC_BIT_SWAPPED))
+                if (!IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)) && BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED) && isPagePinned(descr)
+                    && clusterIterator != clustersTaken.end())
                 {
-                    BIT_SET(pmt0[i].pmt1[j].flags, DESC_BIT_SWAPPED);
-                    BIT_CLEAR(pmt0[i].pmt1[j].flags, DESC_BIT_MAPPED);
-                    BIT_CLEAR(pmt0[i].pmt1[j].flags, DESC_BIT_DIRTY);
-                    BIT_CLEAR(pmt0[i].pmt1[j].flags, DESC_BIT_REFERENCE);
+                    newPmt1[j].flags = FLAGS_LOAD(descr->flags);
+                    BIT_SET(newPmt1[j].flags, DESC_BIT_SWAPPED);
+                    BIT_CLEAR(newPmt1[j].flags, DESC_BIT_MAPPED);
+                    BIT_CLEAR(newPmt1[j].flags, DESC_BIT_DIRTY);
+                    BIT_CLEAR(newPmt1[j].flags, DESC_BIT_REFERENCE);
 
-                    if (BIT_IS_SET(pmt0_[i].pmt1[j].flags, DESC_BIT_MAPPED))
-                    {
-                        FrameNum frame = pmt0_[i].pmt1[j].location;
-                        const char *frameContent = (const char *)system_->processSpace_ + frame * FRAME_SIZE;
-                        memcpy(buffer, frameContent, FRAME_SIZE);
-                    }
-                    else
-                    {
-                        ClusterNo cluster = pmt0_[i].pmt1[j].location;
-                        system_->swapPartition_->readCluster(cluster, buffer);
-                    }
+                    FrameNum frame = descr->location;
+                    const char *frameContent = (const char *)system_->processSpace_ + frame * FRAME_SIZE;
+                    memcpy(buffer, frameContent, PAGE_SIZE);
 
                     ClusterNo cluster = *clusterIterator;
                     ++clusterIterator;
                     system_->swapPartition_->writeCluster(cluster, buffer);
 
-                    pmt0[i].pmt1[j].location = cluster;
+                    newPmt1[j].location = cluster;
+                    continue;
+                }
+
+                // pages in memory or on disk are shared copy-on-write, no frame or cluster is copied
+                if (!IS_SHARED_PAGE(FLAGS_LOAD(descr->flags))
+                    && (BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED) || BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_SWAPPED)))
+                {
+                    makeCopyOnWrite(i, j);
+                }
+                if (IS_COW_PAGE(FLAGS_LOAD(descr->flags)))
+                {
+                    system_->cowPages_[descr->location].processes_.push_back(newProcess);
                 }
+                newPmt1[j] = *descr;
             }
         }
     }
 
-    KernelProcess *newProcess = new KernelProcess(pid, pmt0, system_);
+    // pages unpinned in the meantime were shared instead
+    for (; pageFrameIterator != framesTaken.end(); ++pageFrameIterator)
+    {
+        system_->processSpaceManager_.dealloc(*pageFrameIterator);
+    }
+    for (; clusterIterator != clustersTaken.end(); ++clusterIterator)
+    {
+        system_->diskSpaceManager_.freeCluster(*clusterIterator);
+    }
+
+    if (tablesShared)
+    {
+        // the TLB may allow writes to pages of tables that are copy-on-write now
+        tlb_.flush();
+    }
 
     // copy segment info
     for (auto it = segments_.begin(); it != segments_.end(); ++it)
@@ -529,9 +1441,10 @@ Status KernelProcess::createSharedSegment(VirtualAddress startAddress, PageNum s
 
     // lock object - sensitive operations
     std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
 
-    auto it = KernelProcess::sharedSegments.find(name);
-    if (it == KernelProcess::sharedSegments.end())
+    SharedSegmentDescr *sharedSegment = system_->sharedSegments_.findByName(name);
+    if (sharedSegment == nullptr)
     {
         // new shared segment
         if (addSharedSegment(startAddress, segmentSize, name, flags) != OK)
@@ -543,12 +1456,12 @@ Status KernelProcess::createSharedSegment(VirtualAddress startAddress, PageNum s
     {
         // shared segment already exists
 
-        if (startAddress != it->second->startAddr_ || segmentSize != it->second->size_)
+        if (startAddress != sharedSegment->startAddr_ || segmentSize != sharedSegment->size_)
         {
             return TRAP;
         }
 
-        if (connectToSharedSegment(it->second) != OK)
+        if (connectToSharedSegment(sharedSegment) != OK)
         {
             return TRAP;
         }
@@ -564,87 +1477,508 @@ Status KernelProcess::disconnectSharedSegment(const char *name)
         return TRAP;
     }
 
+    // the tables of the segment are freed once the locks are released
+    Status status = leaveSharedSegment(name);
+    system_->reclaimPmtFrames();
+    return status;
+}
+
+Status KernelProcess::leaveSharedSegment(const char *name)
+{
     // lock object - sensitive operations
     std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
 
-    auto it = KernelProcess::sharedSegments.find(name);
-    if (it == KernelProcess::sharedSegments.end())
+    SharedSegmentDescr *sharedSegment = system_->sharedSegments_.findByName(name);
+    if (sharedSegment == nullptr)
     {
         return TRAP;
     }
 
     KernelProcess *target = this;
     auto procPtr = std::find_if(
-        it->second->processes_.begin(),
-        it->second->processes_.end(),
+        sharedSegment->processes_.begin(),
+        sharedSegment->processes_.end(),
         [target](KernelProcess *p) { return p == target; }
     );
-    if (procPtr == it->second->processes_.end())
+    if (procPtr == sharedSegment->processes_.end())
     {
         return TRAP;
     }
 
-    bool releaseResources = it->second->processes_.size() == 1;
-    SegmentDescr temp(it->second->startAddr_, it->second->size_, it->second->rights_);
+    bool releaseResources = sharedSegment->processes_.size() == 1;
+    SegmentDescr temp(sharedSegment->startAddr_, sharedSegment->size_, sharedSegment->rights_);
     releasePmt1Entries(temp, releaseResources);
-    it->second->processes_.erase(procPtr);
+    if (releaseResources)
+    {
+        // shared level 1 PMTs were released with the last reference
+        std::fill(sharedSegment->sharedPmt1s_.begin(), sharedSegment->sharedPmt1s_.end(), PMT1_NONE);
+    }
+    sharedSegment->processes_.erase(procPtr);
+    return OK;
+}
+
+Status KernelProcess::deleteSharedSegment(const char *name)
+{
+    if (name == nullptr)
+    {
+        return TRAP;
+    }
+
+    // Processes do not exit while the system lock is held, so the ones in
+    // the list stay alive while they are disconnected. A segment that is
+    // being deleted takes no new processes.
+    std::lock_guard<std::mutex> systemLock(system_->mutex_guard_);
+
+    SharedSegmentDescr *sharedSegment;
+    {
+        std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
+        sharedSegment = system_->sharedSegments_.findByName(name);
+        if (sharedSegment == nullptr)
+        {
+            return TRAP;
+        }
+        sharedSegment->dying_ = true;
+    }
+
+    // disconnecting a process removes it from the list, so iterate over a
+    // copy; the processes are locked one by one, after memory_guard_ is released
+    for (;;)
+    {
+        std::vector<KernelProcess *> processes;
+        {
+            std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
+            if (sharedSegment->processes_.empty())
+            {
+                // delete shared segment from the system, its id can be reused
+                system_->sharedSegments_.remove(sharedSegment);
+                system_->usedSharedSegmentIds_.push(sharedSegment->id_);
+                delete sharedSegment;
+                return OK;
+            }
+            processes = sharedSegment->processes_;
+        }
+
+        for (auto p : processes)
+        {
+            p->disconnectSharedSegment(name);
+        }
+    }
+}
+
+// Note: It is assumed that access() method of KernelSystem is called before a call to this method
+// and returned OK. It is also assumed that the page isn't removed from the physical memory
+// after a call to pageFault() and before a call to this method.
+// The periodic job swaps out a suspended process without waiting for it, so
+// the page may be gone since access() all the same (see System::periodicJob()).
+// It is read in again, but only PHYSICAL_ADDRESS_MAX_FAULTS times; returns
+// nullptr if the page could not be kept in memory.
+PhysicalAddress KernelProcess::getPhysicalAddress(VirtualAddress address)
+{
+    PageNum page = address >> BITS_IN_VADDR_OFFSET;
+    for (unsigned int faults = 0; ; ++faults)
+    {
+        // fast path, translation is cached and the reference bit is already set
+        FrameNum frame;
+        if (tlb_.lookup(page, TLB_BIT_REFERENCE, frame))
+        {
+            return (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE + VADDR_OFFSET(address));
+        }
+        Tlb::Entry stamp = tlb_.reserve(page);
+
+        {
+            // the tables are walked without a lock (see translate()), but not across the page fault
+            ProcessTable::ReadSection section(system_->processTable_);
+            unsigned int pmt1 = PMT0_LOAD(pmt0_[VADDR_PMT0_ENTRY(address)].pmt1);
+            if (pmt1 == PMT1_NONE)
+            {
+                return nullptr;
+            }
+
+            // the reference bit is set atomically, no lock is needed for private pages
+            PmtEntry1 *descr = PMT1_ADDRESS(system_->pmtSpace_, pmt1) + VADDR_PMT1_ENTRY(address);
+            std::unique_lock<std::mutex> memoryLock(system_->memory_guard_, std::defer_lock);
+            if (IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)))
+            {
+                // the shared descriptor may be moved or released by other processes
+                memoryLock.lock();
+                if (PMT0_LOAD(pmt0_[VADDR_PMT0_ENTRY(address)].pmt1) != pmt1)
+                {
+                    return nullptr; // the segment was changed meanwhile
+                }
+                descr = stateDescriptor(VADDR_PMT0_ENTRY(address), descr);
+                if (descr == nullptr)
+                {
+                    return nullptr;
+                }
+            }
+
+            frame = LOCATION_LOAD(descr->location);
+            if (setReferenceBit(descr))
+            {
+                unsigned int tlbFlags = Tlb::flagsFromDescriptor(FLAGS_LOAD(descr->flags));
+                if (PMT1_IS_COW(pmt1))
+                {
+                    tlbFlags &= ~TLB_BIT_WRITE; // writes have to fault
+                }
+                tlb_.insert(page, frame, tlbFlags, stamp);
+
+                PhysicalAddress frameAddress = (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE);
+                return (PhysicalAddress)((char *)frameAddress + VADDR_OFFSET(address));
+            }
+        }
+
+        if (faults == PHYSICAL_ADDRESS_MAX_FAULTS || pageFault(address) != OK)
+        {
+            return nullptr;
+        }
+    }
+}
+
+// Does the job of access() and getPhysicalAddress() with a single walk of the
+// page tables: validates the access, sets the reference bit (and the dirty bit
+// for writes) and returns the physical address. Returns PAGE_FAULT if the page
+// is not in memory.
+Status KernelProcess::translate(VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress)
+{
+    if (!IS_VADDR_VALID(address))
+    {
+        return TRAP;
+    }
+
+    // fast path, translation is cached and no bits have to be set
+    PageNum page = address >> BITS_IN_VADDR_OFFSET;
+    FrameNum frame;
+    if (tlb_.lookup(page, Tlb::flagsRequiredFor(type) | TLB_BIT_REFERENCE, frame))
+    {
+        out_physicalAddress = (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE + VADDR_OFFSET(address));
+        return OK;
+    }
+    Tlb::Entry stamp = tlb_.reserve(page);
+
+    // The entry is loaded once, the table it links may be unlinked meanwhile.
+    // It is not freed before the read section ends, see
+    // KernelSystem::reclaimPmtFrames().
+    ProcessTable::ReadSection section(system_->processTable_);
+    unsigned int pmt1 = PMT0_LOAD(pmt0_[VADDR_PMT0_ENTRY(address)].pmt1);
+    if (pmt1 == PMT1_NONE)
+    {
+        return TRAP; // memory access violation
+    }
+
+    PmtEntry1 *descr = PMT1_ADDRESS(system_->pmtSpace_, pmt1) + VADDR_PMT1_ENTRY(address);
+    unsigned int flags = FLAGS_LOAD(descr->flags);
+    if (!BIT_IS_SET(flags, DESC_BIT_VALID) || !isAccessAllowed(flags, type))
+    {
+        return TRAP; // memory access violation
+    }
+
+    bool write = type == WRITE || type == READ_WRITE;
+    if (PMT1_IS_COW(pmt1) && write)
+    {
+        return PAGE_FAULT; // the process gets a table of its own first
+    }
+
+    std::unique_lock<std::mutex> memoryLock(system_->memory_guard_, std::defer_lock);
+    if (IS_SHARED_PAGE(flags))
+    {
+        if (IS_COW_PAGE(flags) && write)
+        {
+            return PAGE_FAULT; // the process gets its own copy of the page first
+        }
+        // the shared descriptor may be moved or released by other processes
+        memoryLock.lock();
+        if (PMT0_LOAD(pmt0_[VADDR_PMT0_ENTRY(address)].pmt1) != pmt1)
+        {
+            return PAGE_FAULT; // the segment was changed meanwhile, the page fault sorts it out
+        }
+        descr = stateDescriptor(VADDR_PMT0_ENTRY(address), descr);
+        if (descr == nullptr)
+        {
+            return TRAP;
+        }
+    }
+
+    if (!BIT_IS_SET(FLAGS_LOAD(descr->flags), DESC_BIT_MAPPED))
+    {
+        return PAGE_FAULT;
+    }
+
+    // one atomic operation marks the page, page replacement may clear the bits at any time;
+    // the periodic job may swap the page out meanwhile, the frame is only good if it is still mapped
+    frame = LOCATION_LOAD(descr->location);
+    if (!BIT_IS_SET(BIT_SET(descr->flags, write ? DESC_BIT_REFERENCE | DESC_BIT_DIRTY : DESC_BIT_REFERENCE), DESC_BIT_MAPPED))
+    {
+        return PAGE_FAULT;
+    }
+    unsigned int tlbFlags = Tlb::flagsFromDescriptor(FLAGS_LOAD(descr->flags));
+    if (PMT1_IS_COW(pmt1))
+    {
+        tlbFlags &= ~TLB_BIT_WRITE; // writes have to fault
+    }
+    tlb_.insert(page, frame, tlbFlags, stamp);
+
+    out_physicalAddress = (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE + VADDR_OFFSET(address));
+    return OK;
+}
+
+Status KernelProcess::read(VirtualAddress address, void *buffer, unsigned long length)
+{
+    return copy(address, (char *)buffer, length, READ);
+}
+
+Status KernelProcess::write(VirtualAddress address, const void *buffer, unsigned long length)
+{
+    return copy(address, (char *)buffer, length, WRITE);
+}
+
+// Copies between the buffer and the virtual memory of the process straight
+// from/to the frames, page by page, setting the reference and dirty bits on
+// the way. Missing pages are faulted in COPY_BATCH_PAGES at a time (or less,
+// so that a window does not evict itself when the process is at its quota).
+// The buffer is written to only if type is READ.
+Status KernelProcess::copy(VirtualAddress address, char *buffer, unsigned long length, AccessType type)
+{
+    if (length == 0)
+    {
+        return OK;
+    }
+
+    VirtualAddress endAddress = address + length;
+    VirtualAddress lastAddress = endAddress - 1;
+    if (endAddress < address || !IS_VADDR_VALID(address) || !IS_VADDR_VALID(lastAddress))
+    {
+        return TRAP;
+    }
+
+    while (address < endAddress)
+    {
+        // fault in the missing pages of the next window at once
+        VirtualAddress faults[COPY_BATCH_PAGES];
+        unsigned int numFaults = 0;
+        PageNum window = std::min<PageNum>(COPY_BATCH_PAGES, quota_);
+        VirtualAddress page = address & ~(VirtualAddress)(PAGE_SIZE - 1);
+        for (PageNum i = 0; i < window && page < endAddress; ++i, page += PAGE_SIZE)
+        {
+            PhysicalAddress pa;
+            Status status = translate(page, type, pa);
+            if (status == TRAP)
+            {
+                return TRAP;
+            }
+            if (status == PAGE_FAULT)
+            {
+                faults[numFaults++] = page;
+            }
+        }
+        if (numFaults > 0 && pageFaults(faults, numFaults) != OK)
+        {
+            return TRAP;
+        }
+
+        // copy the window, pages evicted in the meantime are faulted in again
+        VirtualAddress windowEnd = std::min(page, endAddress);
+        while (address < windowEnd)
+        {
+            PhysicalAddress pa;
+            Status status;
+            while ((status = translate(address, type, pa)) == PAGE_FAULT)
+            {
+                if (pageFault(address) != OK)
+                {
+                    return TRAP;
+                }
+            }
+            if (status != OK)
+            {
+                return TRAP;
+            }
+
+            // the page stays in its frame while it is copied
+            if (!pinPage(address, type, pa, false))
+            {
+                continue;
+            }
+
+            unsigned long chunk = std::min<unsigned long>(windowEnd - address, PAGE_SIZE - VADDR_OFFSET(address));
+            if (type == READ)
+            {
+                memcpy(buffer, pa, chunk);
+            }
+            else
+            {
+                memcpy(pa, buffer, chunk);
+            }
+            --system_->framePins_[((char *)pa - (char *)system_->processSpace_) / FRAME_SIZE];
+            address += chunk;
+            buffer += chunk;
+        }
+    }
+
+    return OK;
+}
+
+// Translates the range page by page, faulting in missing pages, and pins
+// every page so that it stays in memory until releaseRange(). Pages that
+// are contiguous in physical memory are merged into one extent. On failure
+// nothing stays pinned.
+Status KernelProcess::translateRange(VirtualAddress address, unsigned long length, AccessType type, std::vector<Extent> &out_extents)
+{
+    out_extents.clear();
+    if (length == 0)
+    {
+        return OK;
+    }
+
+    VirtualAddress endAddress = address + length;
+    VirtualAddress lastAddress = endAddress - 1;
+    if (endAddress < address || !IS_VADDR_VALID(address) || !IS_VADDR_VALID(lastAddress))
+    {
+        return TRAP;
+    }
+
+    while (address < endAddress)
+    {
+        PhysicalAddress pa;
+        for (;;)
+        {
+            Status status;
+            while ((status = translate(address, type, pa)) == PAGE_FAULT)
+            {
+                if (pageFault(address) != OK)
+                {
+                    status = TRAP;
+                    break;
+                }
+            }
+            if (status != OK)
+            {
+                releaseRange(out_extents);
+                out_extents.clear();
+                return TRAP;
+            }
+
+            if (pinPage(address, type, pa, true))
+            {
+                break;
+            }
+        }
+
+        unsigned long chunk = std::min<unsigned long>(endAddress - address, PAGE_SIZE - VADDR_OFFSET(address));
+        if (!out_extents.empty()
+            && (char *)out_extents.back().address_ + out_extents.back().length_ == (char *)pa)
+        {
+            out_extents.back().length_ += chunk;
+        }
+        else
+        {
+            out_extents.push_back(Extent(pa, chunk));
+        }
+        address += chunk;
+    }
+
     return OK;
 }
 
-Status KernelProcess::deleteSharedSegment(const char *name)
+// Pins the page that translate() found at pa, unless it was evicted in the
+// meantime. Pins are taken under the memory lock, which eviction holds from
+// its pin check until the frame is unmapped. A pin held until releaseRange()
+// is recorded for the process, so that only the process can release it.
+bool KernelProcess::pinPage(VirtualAddress address, AccessType type, PhysicalAddress pa, bool untilRelease)
+{
+    FrameNum frame = ((char *)pa - (char *)system_->processSpace_) / FRAME_SIZE;
+    std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
+    if (!isPageInFrame(address, type, frame))
+    {
+        return false;
+    }
+    ++system_->framePins_[frame];
+    if (untilRelease)
+    {
+        system_->framePinners_[frame].push_back(this);
+        ++pins_;
+    }
+    return true;
+}
+
+// Whether the page at address is still in frame and allows the access
+// without a fault.
+// Note: The caller has to hold memory_guard_.
+bool KernelProcess::isPageInFrame(VirtualAddress address, AccessType type, FrameNum frame) const
 {
-    if (name == nullptr)
+    int pmt0Entry = VADDR_PMT0_ENTRY(address);
+    if (pmt0_[pmt0Entry].pmt1 == PMT1_NONE)
     {
-        return TRAP;
+        return false;
     }
 
-    auto it = KernelProcess::sharedSegments.find(name);
-    if (it == KernelProcess::sharedSegments.end())
+    PmtEntry1 *descr = pmt1Table(pmt0Entry) + VADDR_PMT1_ENTRY(address);
+    unsigned int flags = FLAGS_LOAD(descr->flags);
+    if (!BIT_IS_SET(flags, DESC_BIT_VALID) || !isAccessAllowed(flags, type))
     {
-        return TRAP;
+        return false;
     }
-
-    for (auto p : it->second->processes_)
+    if (type != READ && type != EXECUTE && IS_COW_PAGE(flags))
     {
-        p->disconnectSharedSegment(name);
+        return false; // became copy-on-write, the write faults to copy it
     }
 
-    // delete shared segment from the system
-    KernelProcess::sharedSegments.erase(name);
-
-    return OK;
+    PmtEntry1 *page = stateDescriptor(pmt0Entry, descr);
+    return page != nullptr && BIT_IS_SET(FLAGS_LOAD(page->flags), DESC_BIT_MAPPED) && page->location == frame;
 }
 
-// Note: It is assumed that access() method of KernelSystem is called before a call to this method
-// and returned OK. It is also assumed that the page isn't removed from the physical memory
-// after a call to pageFault() and before a call to this method.
-PhysicalAddress KernelProcess::getPhysicalAddress(VirtualAddress address)
+// Unpins the pages of extents returned by translateRange(). A process
+// releases only the pins it took itself, so a repeated release or one of
+// extents of another process fails. The extents are checked first; on
+// failure no page is unpinned.
+Status KernelProcess::releaseRange(const std::vector<Extent> &extents)
 {
-    std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
 
-    PmtEntry1 *descr = pmt0_[VADDR_PMT0_ENTRY(address)].pmt1 + VADDR_PMT1_ENTRY(address);
-    FrameNum frame = descr->location;
-    if (SHARED_SEGMENT_ID(descr->flags) > 0)
+    // one entry per pin to release, a frame is in as many extents as it was pinned
+    std::vector<FrameNum> frames;
+    for (const Extent &extent : extents)
     {
-        SharedSegmentDescr *ssd = findSharedSegmentById(SHARED_SEGMENT_ID(descr->flags));
-        if (ssd)
+        if (extent.length_ == 0)
         {
-            VirtualAddress startAddress = SHARED_PAGE_ID(descr->flags) << BITS_IN_VADDR_OFFSET;
-            int pmt0Entry = VADDR_PMT0_ENTRY(startAddress);
-            int pmt1Entry = VADDR_PMT1_ENTRY(startAddress);
-            for (auto it : ssd->processes_)
-            {
-                BIT_SET(it->pmt0_[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_REFERENCE);
-            }
+            continue;
+        }
+
+        FrameNum first = ((char *)extent.address_ - (char *)system_->processSpace_) / FRAME_SIZE;
+        FrameNum last = ((char *)extent.address_ + extent.length_ - 1 - (char *)system_->processSpace_) / FRAME_SIZE;
+        if (extent.address_ < system_->processSpace_ || last >= system_->framePins_.size())
+        {
+            return TRAP;
+        }
+
+        for (FrameNum frame = first; frame <= last; ++frame)
+        {
+            frames.push_back(frame);
         }
     }
-    else
+
+    std::sort(frames.begin(), frames.end());
+    for (std::size_t i = 0, j = 0; i < frames.size(); i = j)
     {
-        BIT_SET(descr->flags, DESC_BIT_REFERENCE);
+        while (j < frames.size() && frames[j] == frames[i])
+        {
+            ++j;
+        }
+        const std::vector<KernelProcess *> &pinners = system_->framePinners_[frames[i]];
+        if ((std::size_t)std::count(pinners.begin(), pinners.end(), this) < j - i)
+        {
+            return TRAP;
+        }
     }
-    PhysicalAddress frameAddress = (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE);
-    PhysicalAddress physicalAddress = (PhysicalAddress)((char *)frameAddress + VADDR_OFFSET(address));
-    return physicalAddress;
+
+    for (FrameNum frame : frames)
+    {
+        std::vector<KernelProcess *> &pinners = system_->framePinners_[frame];
+        pinners.erase(std::find(pinners.begin(), pinners.end(), this));
+        --system_->framePins_[frame];
+        --pins_;
+    }
+    return OK;
 }
 
 inline bool isOverlap(const SegmentDescr &sd1, const SegmentDescr &sd2)
@@ -654,11 +1988,21 @@ inline bool isOverlap(const SegmentDescr &sd1, const SegmentDescr &sd2)
     return !(sd2.startAddr_ > sd1EndAddr || sd1.startAddr_ > sd2EndAddr);
 }
 
-inline bool isOverlap(SharedSegmentDescr *ssd1, SharedSegmentDescr *ssd2)
+bool KernelProcess::isAccessAllowed(unsigned int descrFlags, AccessType type)
 {
-    VirtualAddress ssd1EndAddr = ssd1->startAddr_ + ssd1->size_ * PAGE_SIZE - 1;
-    VirtualAddress ssd2EndAddr = ssd2->startAddr_ + ssd2->size_ * PAGE_SIZE - 1;
-    return !(ssd2->startAddr_ > ssd1EndAddr || ssd1->startAddr_ > ssd2EndAddr);
+    switch (type)
+    {
+    case READ:
+        return BIT_IS_SET(descrFlags, DESC_BIT_READ);
+    case WRITE:
+        return BIT_IS_SET(descrFlags, DESC_BIT_WRITE);
+    case READ_WRITE:
+        return BIT_IS_SET(descrFlags, DESC_BIT_READ) && BIT_IS_SET(descrFlags, DESC_BIT_WRITE);
+    case EXECUTE:
+        return BIT_IS_SET(descrFlags, DESC_BIT_EXEC);
+    default:
+        return false; // invalid access type
+    }
 }
 
 Status KernelProcess::validateSegmentInfo(VirtualAddress startAddr, PageNum segmentSize, AccessType flags)
@@ -694,9 +2038,24 @@ Status KernelProcess::addSegment(VirtualAddress startAddr, PageNum segmentSize,
 {
     // lock object - sensitive operations
     std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
+
+    // shared segments are not in segments_, look for them in the page tables
+    VirtualAddress addr = startAddr;
+    VirtualAddress endAddr = startAddr + segmentSize * PAGE_SIZE - 1;
+    while (addr <= endAddr)
+    {
+        unsigned entry = VADDR_PMT0_ENTRY(addr);
+        unsigned lastIdx = VADDR_PMT0_ENTRY(endAddr) == entry ? VADDR_PMT1_ENTRY(endAddr) : PMT_1_NUM_ENTRIES - 1;
+        if (pmt1Summary_[entry].valid & PMT1_RANGE_MASK(VADDR_PMT1_ENTRY(addr), lastIdx))
+        {
+            return TRAP;
+        }
+        addr += (lastIdx - VADDR_PMT1_ENTRY(addr) + 1) * PAGE_SIZE;
+    }
 
     SegmentDescr newSegmentDescr(startAddr, segmentSize, flags);
-    if (initPmt1Entries(newSegmentDescr, 0) != OK)
+    if (initPmt1Entries(newSegmentDescr, nullptr) != OK)
     {
         return TRAP;
     }
@@ -706,45 +2065,55 @@ Status KernelProcess::addSegment(VirtualAddress startAddr, PageNum segmentSize,
 
 Status KernelProcess::addSharedSegment(VirtualAddress startAddr, PageNum segmentSize, const char *name, AccessType flags)
 {
+    if (system_->sharedSegments_.overlaps(startAddr, segmentSize))
+    {
+        return TRAP;
+    }
+
     unsigned int id;
-    if (!KernelProcess::usedSharedSegmentIds.empty())
+    if (!system_->usedSharedSegmentIds_.empty())
     {
-        id = KernelProcess::usedSharedSegmentIds.top();
-        KernelProcess::usedSharedSegmentIds.pop();
+        id = system_->usedSharedSegmentIds_.top();
+        system_->usedSharedSegmentIds_.pop();
     }
     else
     {
-        if (KernelProcess::nextUnusedSharedSegmentId == SHARED_SEGMENT_ID_LIMIT)
+        if (system_->nextUnusedSharedSegmentId_ == SHARED_SEGMENT_ID_LIMIT)
         {
             return TRAP;
         }
-        id = KernelProcess::nextUnusedSharedSegmentId++;
+        id = system_->nextUnusedSharedSegmentId_++;
     }
 
     SharedSegmentDescr *newSharedSegmentDescr = new SharedSegmentDescr(startAddr, segmentSize, id, name, flags);
-    for (auto it : KernelProcess::sharedSegments)
+    SegmentDescr temp(startAddr, segmentSize, flags);
+    if (initPmt1Entries(temp, newSharedSegmentDescr) != OK)
     {
-        if (isOverlap(newSharedSegmentDescr, it.second))
-        {
-            KernelProcess::usedSharedSegmentIds.push(id);
-            return TRAP;
-        }
+        system_->usedSharedSegmentIds_.push(id);
+        delete newSharedSegmentDescr;
+        return TRAP;
     }
 
-    SegmentDescr temp(startAddr, segmentSize, flags);
-    if (initPmt1Entries(temp, id) != OK)
+    // the pages start out like the descriptors of the first process: valid, neither mapped nor swapped
+    VirtualAddress addr = startAddr;
+    for (PmtEntry1 &page : newSharedSegmentDescr->pages_)
     {
-        KernelProcess::usedSharedSegmentIds.push(id);
-        return TRAP;
+        page.flags = FLAGS_LOAD(pmt1Table(VADDR_PMT0_ENTRY(addr))[VADDR_PMT1_ENTRY(addr)].flags);
+        addr += PAGE_SIZE;
     }
 
     newSharedSegmentDescr->processes_.push_back(this); // add this process to the list of processes
-    KernelProcess::sharedSegments[newSharedSegmentDescr->name_] = newSharedSegmentDescr;
+    system_->sharedSegments_.insert(newSharedSegmentDescr);
     return OK;
 }
 
 Status KernelProcess::connectToSharedSegment(SharedSegmentDescr *descr)
 {
+    if (descr->dying_)
+    {
+        return TRAP;
+    }
+
     for (KernelProcess *const p : descr->processes_)
     {
         if (p == this) // if already connected to this segment
@@ -753,47 +2122,12 @@ Status KernelProcess::connectToSharedSegment(SharedSegmentDescr *descr)
         }
     }
 
-    PmtEntry0 *otherPmt0 = nullptr;
-    if (descr->processes_.size() > 0)
-    {
-        otherPmt0 = descr->processes_.front()->pmt0_;
-    }
-
     SegmentDescr temp(descr->startAddr_, descr->size_, descr->rights_);
-    if (initPmt1Entries(temp, descr->id_) != OK)
+    if (initPmt1Entries(temp, descr) != OK)
     {
         return TRAP;
     }
 
-    if (otherPmt0) // if there was any other process connected to the segment
-    {
-        VirtualAddress addr = descr->startAddr_;
-        for (unsigned int i = 0; i < descr->size_; ++i)
-        {
-            PmtEntry1 *pmt1EntryOther = otherPmt0[VADDR_PMT0_ENTRY(addr)].pmt1 + VADDR_PMT1_ENTRY(addr);
-            PmtEntry1 *pmt1Entry = pmt0_[VADDR_PMT0_ENTRY(addr)].pmt1 + VADDR_PMT1_ENTRY(addr);
-
-            if (BIT_IS_SET(pmt1EntryOther->flags, DESC_BIT_DIRTY))
-            {
-                BIT_SET(pmt1Entry->flags, DESC_BIT_DIRTY);
-            }
-            if (BIT_IS_SET(pmt1EntryOther->flags, DESC_BIT_SWAPPED))
-            {
-                BIT_SET(pmt1Entry->flags, DESC_BIT_SWAPPED);
-            }
-            if (BIT_IS_SET(pmt1EntryOther->flags, DESC_BIT_REFERENCE))
-            {
-                BIT_SET(pmt1Entry->flags, DESC_BIT_REFERENCE);
-            }
-            if (BIT_IS_SET(pmt1EntryOther->flags, DESC_BIT_MAPPED))
-            {
-                BIT_SET(pmt1Entry->flags, DESC_BIT_MAPPED);
-            }
-
-            addr += PAGE_SIZE;
-        }
-    }
-
     descr->processes_.push_back(this);
     return OK;
 }
@@ -802,6 +2136,7 @@ Status KernelProcess::removeSegment(VirtualAddress startAddr)
 {
     // lock object - sensitive operations
     std::lock_guard<std::mutex> lock(mutex_guard_);
+    std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
 
     auto it = std::find_if(
         segments_.begin(),
@@ -815,27 +2150,42 @@ Status KernelProcess::removeSegment(VirtualAddress startAddr)
         return TRAP;
     }
 
-    releasePmt1Entries(*it, true);
+    if (releasePmt1Entries(*it, true) != OK)
+    {
+        return TRAP;
+    }
     segments_.erase(it);
     return OK;
 }
 
 // Note: The caller has to make sure that the segment is valid before
 //       a call to this function.
-Status KernelProcess::initPmt1Entries(const SegmentDescr &sd, unsigned int sharedSegmentId)
+// Level 1 PMTs of a shared segment that are already in use by other
+// processes are shared, not allocated; see SharedSegmentDescr.
+Status KernelProcess::initPmt1Entries(const SegmentDescr &sd, SharedSegmentDescr *sharedSegment)
 {
-    static PhysicalAddress frameStack[PMT_0_NUM_ENTRIES];
-    static unsigned sp = 0;
+    PhysicalAddress frameStack[PMT_0_NUM_ENTRIES];
+    unsigned sp = 0;
 
     VirtualAddress endAddr = sd.startAddr_ + sd.size_ * PAGE_SIZE - 1;
     unsigned firstPmt0Entry = VADDR_PMT0_ENTRY(sd.startAddr_);
     unsigned lastPmt0Entry = VADDR_PMT0_ENTRY(endAddr);
     bool pmt1FramesAllocFailed = false;
+    unsigned int sharedSegmentId = sharedSegment ? sharedSegment->id_ : 0;
 
-    sp = 0;
+    // copy-on-write tables of the range are changed, the process needs tables of its own
     for (unsigned entry = firstPmt0Entry; entry <= lastPmt0Entry; ++entry)
     {
-        if (!pmt0_[entry].pmt1)
+        if (PMT1_IS_COW(pmt0_[entry].pmt1) && unshareTable(entry) != OK)
+        {
+            return TRAP;
+        }
+    }
+
+    for (unsigned entry = firstPmt0Entry; entry <= lastPmt0Entry; ++entry)
+    {
+        unsigned int *shared = sharedSegment ? sharedSegment->sharedPmt1(entry) : nullptr;
+        if (!pmt0_[entry].pmt1 && !(shared && *shared != PMT1_NONE))
         {
             PhysicalAddress pa = system_->pmtSpaceManager_.alloc();
             if (!pa)
@@ -856,55 +2206,80 @@ Status KernelProcess::initPmt1Entries(const SegmentDescr &sd, unsigned int share
         return TRAP;
     }
 
+    // flags are the same for all pages of the segment
+    unsigned int flags = DESC_BIT_VALID;
+    switch (sd.rights_)
+    {
+    default:
+        break;
+    case READ:
+        BIT_SET(flags, DESC_BIT_READ);
+        break;
+    case WRITE:
+        BIT_SET(flags, DESC_BIT_WRITE);
+        break;
+    case READ_WRITE:
+        BIT_SET(flags, DESC_BIT_READ);
+        BIT_SET(flags, DESC_BIT_WRITE);
+        break;
+    case EXECUTE:
+        BIT_SET(flags, DESC_BIT_EXEC);
+        break;
+    }
+    if (sharedSegmentId != 0)
+    {
+        BIT_SET(flags, DESC_BIT_SHARED);
+    }
+
     VirtualAddress addr = sd.startAddr_;
     for (unsigned entry = firstPmt0Entry; entry <= lastPmt0Entry; ++entry)
     {
-        if (!pmt0_[entry].pmt1)
+        unsigned int *shared = sharedSegment ? sharedSegment->sharedPmt1(entry) : nullptr;
+        if (shared && *shared != PMT1_NONE)
         {
-            pmt0_[entry].pmt1 = (PmtEntry1 *)frameStack[--sp];
-            for (int i = 0; i < PMT_1_NUM_ENTRIES; ++i)
-            {
-                pmt0_[entry].pmt1[i].flags = 0;
-                pmt0_[entry].pmt1[i].location = 0;
-                pmt0_[entry].pmt1[i].next = nullptr;
-                pmt0_[entry].pmt1[i].prev = nullptr;
-            }
+            // connect to the table of the other processes
+            PMT0_STORE(pmt0_[entry].pmt1, *shared);
+            ++system_->pmtRefs_[PMT1_FRAME(*shared)];
+            pmt1Summary_[entry].valid = ~0ULL;
+            addr += PMT_1_NUM_ENTRIES * PAGE_SIZE;
+            continue;
         }
 
-        PmtEntry1 *pmt1 = pmt0_[entry].pmt1;
+        // a new table is filled in before it is linked, translate() may walk it right away
+        PmtEntry1 *pmt1;
+        if (!pmt0_[entry].pmt1)
+        {
+            pmt1 = (PmtEntry1 *)frameStack[--sp];
+            memset(pmt1, 0, PMT_1_NUM_ENTRIES * sizeof(PmtEntry1));
+        }
+        else
+        {
+            pmt1 = pmt1Table(entry);
+        }
+        unsigned firstIdx = VADDR_PMT1_ENTRY(addr);
+        unsigned lastIdx = firstIdx;
         while (VADDR_PMT0_ENTRY(addr) == entry && addr < endAddr)
         {
-            unsigned idx = VADDR_PMT1_ENTRY(addr);
-
-            BIT_SET(pmt1[idx].flags, DESC_BIT_VALID);
-
-            switch (sd.rights_)
-            {
-            default:
-                break;
-            case READ:
-                BIT_SET(pmt1[idx].flags, DESC_BIT_READ);
-                break;
-            case WRITE:
-                BIT_SET(pmt1[idx].flags, DESC_BIT_WRITE);
-                break;
-            case READ_WRITE:
-                BIT_SET(pmt1[idx].flags, DESC_BIT_READ);
-                BIT_SET(pmt1[idx].flags, DESC_BIT_WRITE);
-                break;
-            case EXECUTE:
-                BIT_SET(pmt1[idx].flags, DESC_BIT_EXEC);
-                break;
-            }
-
-            if (sharedSegmentId != 0)
-            {
-                ASSIGN_SHARED_SEGMENT(pmt1[idx].flags, sharedSegmentId);
-                SET_SHARED_PAGE_ID(pmt1[idx].flags, addr >> BITS_IN_VADDR_OFFSET);
-            }
+            lastIdx = VADDR_PMT1_ENTRY(addr);
+            FLAGS_STORE(pmt1[lastIdx].flags, flags);
+            // a shared table holds the state of the pages, the others the segment id
+            LOCATION_STORE(pmt1[lastIdx].location, shared ? 0 : sharedSegmentId);
 
             addr += PAGE_SIZE;
         }
+        pmt1Summary_[entry].valid |= PMT1_RANGE_MASK(firstIdx, lastIdx);
+
+        if (!pmt0_[entry].pmt1 || shared)
+        {
+            // the first process to use a shared table marks it so
+            PMT0_STORE(pmt0_[entry].pmt1, PMT1_REFERENCE(system_->pmtSpace_, pmt1) | (shared ? PMT0_BIT_SHARED : 0));
+        }
+        if (shared)
+        {
+            *shared = pmt0_[entry].pmt1;
+            system_->pmtRefs_[PMT1_FRAME(*shared)] = 1;
+            system_->pmtSharedSegments_[PMT1_FRAME(*shared)] = sharedSegmentId;
+        }
     }
 
     return OK;
@@ -913,121 +2288,113 @@ Status KernelProcess::initPmt1Entries(const SegmentDescr &sd, unsigned int share
 // returns a flag indicating if some other segment uses givem PMT1
 bool KernelProcess::invalidateEntries(int pmt0Entry, int pmt1StartEntry, int pmt1EndEntry, bool releaseResources)
 {
-    bool entriesBeforeStartEntryInUse = false;
-    for (int i = 0; i < pmt1StartEntry; ++i)
+    unsigned long long range = PMT1_RANGE_MASK(pmt1StartEntry, pmt1EndEntry);
+    bool otherEntriesInUse = (pmt1Summary_[pmt0Entry].valid & ~range) != 0;
+
+    // invalidate valid entries starting from pmt1StartEntry, ending with pmt1EndEntry
+    unsigned long long entries = pmt1Summary_[pmt0Entry].valid & range;
+    pmt1Summary_[pmt0Entry].valid &= ~range;
+    pmt1Summary_[pmt0Entry].mapped &= ~range;
+    while (entries)
     {
-        if (BIT_IS_SET(pmt0_[pmt0Entry].pmt1[i].flags, DESC_BIT_VALID))
+        int i = maskLowestBit(entries);
+        entries &= entries - 1;
+        PmtEntry1 *descr = pmt1Table(pmt0Entry) + i;
+
+        if (IS_COW_PAGE(FLAGS_LOAD(descr->flags)))
         {
-            entriesBeforeStartEntryInUse = true;
-            break;
+            releaseCowPage(descr->location);
+            FLAGS_STORE(descr->flags, 0);
+            LOCATION_STORE(descr->location, 0);
+            tlb_.invalidate((pmt0Entry << BITS_IN_VADDR_PMT1_ENTRY) | i);
+            continue;
         }
-    }
 
-    bool entriesAfterEndEntryInUse = false;
-    for (int i = pmt1EndEntry + 1; i < PMT_1_NUM_ENTRIES; ++i)
-    {
-        if (BIT_IS_SET(pmt0_[pmt0Entry].pmt1[i].flags, DESC_BIT_VALID))
+        // a shared page stays as it is while other processes are connected to the segment
+        PmtEntry1 *page = descr;
+        if (IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)))
         {
-            entriesAfterEndEntryInUse = true;
-            break;
+            page = releaseResources ? stateDescriptor(pmt0Entry, descr) : nullptr;
         }
-    }
 
-    // invalidate entries starting from pmt1StartEntry, ending with pmt1EndEntry
-    for (int i = pmt1StartEntry; i <= pmt1EndEntry; ++i)
-    {
-        PmtEntry1 *descr = pmt0_[pmt0Entry].pmt1 + i;
+        if (page && isInClock(page))
+        {
+            // unlink from page replacement list
+            removeFromClock(page);
+        }
 
-        if (descr->prev && descr->next)
+        if (page && releaseResources)
         {
-            if (SHARED_SEGMENT_ID(descr->flags) > 0 && !releaseResources)
+            // release resources taken by the descriptor
+            if (BIT_IS_SET(FLAGS_LOAD(page->flags), DESC_BIT_MAPPED)) // descr holds frame
             {
-                SharedSegmentDescr *ssd = findSharedSegmentById(SHARED_SEGMENT_ID(descr->flags));
-                KernelProcess *thisProc = this;
-                auto procPtr = std::find_if(
-                    ssd->processes_.begin(),
-                    ssd->processes_.end(),
-                    [thisProc](KernelProcess *p) { return p != thisProc; }
-                );
-                KernelProcess *replacementProc = *procPtr;
-                PmtEntry1 *replacementDescr = replacementProc->pmt0_[pmt0Entry].pmt1 + i;
-
-                if (descr->next == descr)
+                FrameNum frame = page->location;
+                resetFrame(frame);
+                PhysicalAddress frameAddress = (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE);
+                system_->processSpaceManager_.dealloc(frameAddress);
+                if (!IS_SHARED_PAGE(FLAGS_LOAD(page->flags)))
                 {
-                    replacementDescr->next = replacementDescr->prev = replacementDescr;
-                    KernelProcess::clockHand = replacementDescr;
+                    --residentCount_;
                 }
-                else
+                if (BIT_IS_SET(FLAGS_LOAD(page->flags), DESC_BIT_SWAPPED)) // and a backing cluster on disk
                 {
-                    replacementDescr->prev = descr->prev;
-                    replacementDescr->next = descr->next;
-                    descr->prev->next = replacementDescr;
-                    descr->next->prev = replacementDescr;
-                    if (KernelProcess::clockHand == descr)
-                    {
-                        KernelProcess::clockHand = replacementDescr;
-                    }
+                    system_->diskSpaceManager_.freeCluster(system_->frameClusters_[frame]);
                 }
             }
-            else
+            else if (BIT_IS_SET(FLAGS_LOAD(page->flags), DESC_BIT_SWAPPED)) // descr holds cluster on disk
             {
-                // unlink from page replacement list
-                if (descr == KernelProcess::clockHand)
-                {
-                    KernelProcess::clockHand = KernelProcess::clockHand->next;
-                    if (descr == KernelProcess::clockHand)
-                    {
-                        KernelProcess::clockHand = nullptr;
-                    }
-                }
-                descr->prev->next = descr->next;
-                descr->next->prev = descr->prev;
-
-                /*KernelProcess::clockHand = KernelProcess::clockHand->next;
-                if (descr == KernelProcess::clockHand)
-                {
-                    KernelProcess::clockHand = nullptr;
-                }
-                descr->prev->next = descr->next;
-                descr->next->prev = descr->prev;*/
+                system_->diskSpaceManager_.freeCluster((ClusterNo)page->location);
             }
-        }
 
-        if (releaseResources)
-        {
-            // release resources taken by the descriptor
-            if (BIT_IS_SET(descr->flags, DESC_BIT_MAPPED)) // descr holds frame
+            if (page != descr)
             {
-                FrameNum frame = descr->location;
-                PhysicalAddress frameAddress = (PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE);
-                system_->processSpaceManager_.dealloc(frameAddress);
-            }
-            else if (BIT_IS_SET(descr->flags, DESC_BIT_SWAPPED)) // descr holds cluster on disk
-            {
-                system_->diskSpaceManager_.freeCluster((ClusterNo)descr->location);
+                // back to the state of a new shared page, for the next process to connect
+                BIT_CLEAR(page->flags, DESC_BIT_MAPPED | DESC_BIT_SWAPPED | DESC_BIT_DIRTY | DESC_BIT_REFERENCE);
+                LOCATION_STORE(page->location, 0);
             }
         }
 
-        descr->flags = 0;
-        descr->location = 0;
-        descr->prev = nullptr;
-        descr->next = nullptr;
+        FLAGS_STORE(descr->flags, 0);
+        LOCATION_STORE(descr->location, 0);
+        tlb_.invalidate((pmt0Entry << BITS_IN_VADDR_PMT1_ENTRY) | i);
     }
 
-    return entriesBeforeStartEntryInUse || entriesAfterEndEntryInUse;
+    return otherEntriesInUse;
 }
 
 // Note: The caller has to make sure that the segment is valid before
-// a call to this function.
+// a call to this function. Tables that are unlinked are retired, the
+// caller frees them with KernelSystem::reclaimPmtFrames() after it
+// releases memory_guard_.
 Status KernelProcess::releasePmt1Entries(const SegmentDescr &sd, bool releaseResources)
 {
     VirtualAddress endAddr = sd.startAddr_ + sd.size_ * PAGE_SIZE - 1;
     VirtualAddress addr = sd.startAddr_;
-    long descrsLeft = sd.size_;
+    PageNum descrsLeft = sd.size_;
+
+    // A copy-on-write table is left to the other processes if none of its
+    // pages stay with this process, and copied first otherwise.
+    unsigned firstPmt0Entry = VADDR_PMT0_ENTRY(sd.startAddr_);
+    unsigned lastPmt0Entry = VADDR_PMT0_ENTRY(endAddr);
+    for (unsigned entry = firstPmt0Entry; entry <= lastPmt0Entry; ++entry)
+    {
+        if (!PMT1_IS_COW(pmt0_[entry].pmt1))
+        {
+            continue;
+        }
+
+        int first = entry == firstPmt0Entry ? VADDR_PMT1_ENTRY(sd.startAddr_) : 0;
+        int last = entry == lastPmt0Entry ? VADDR_PMT1_ENTRY(endAddr) : PMT_1_NUM_ENTRIES - 1;
+        bool pagesLeft = (pmt1Summary_[entry].valid & ~PMT1_RANGE_MASK(first, last)) != 0;
+        if ((pagesLeft || system_->pmtRefs_[PMT1_FRAME(pmt0_[entry].pmt1)] == 1) && unshareTable(entry) != OK)
+        {
+            return TRAP;
+        }
+    }
 
     while (descrsLeft)
     {
-        int pmt0Entry = VADDR_PMT0_ENTRY(addr);
+        unsigned pmt0Entry = VADDR_PMT0_ENTRY(addr);
         int pmt1StartEntry = VADDR_PMT1_ENTRY(addr);
         int pmt1EndEntry = pmt1StartEntry - 1;
         while (descrsLeft && VADDR_PMT0_ENTRY(addr) == pmt0Entry)
@@ -1037,19 +2404,245 @@ Status KernelProcess::releasePmt1Entries(const SegmentDescr &sd, bool releaseRes
             ++pmt1EndEntry;
         }
 
+        if (PMT1_IS_COW(pmt0_[pmt0Entry].pmt1))
+        {
+            leaveTable(pmt0Entry);
+            continue;
+        }
+
+        if (PMT1_IS_SHARED(pmt0_[pmt0Entry].pmt1))
+        {
+            // a shared table is released with its last reference, other processes still use it before that
+            unsigned int pmt1 = pmt0_[pmt0Entry].pmt1;
+            if (--system_->pmtRefs_[PMT1_FRAME(pmt1)] == 0)
+            {
+                invalidateEntries(pmt0Entry, pmt1StartEntry, pmt1EndEntry, releaseResources);
+                system_->retiredPmtFrames_.push_back((PhysicalAddress)pmt1Table(pmt0Entry));
+            }
+            else
+            {
+                for (int i = pmt1StartEntry; i <= pmt1EndEntry; ++i)
+                {
+                    tlb_.invalidate((pmt0Entry << BITS_IN_VADDR_PMT1_ENTRY) | i);
+                }
+            }
+            PMT0_STORE(pmt0_[pmt0Entry].pmt1, PMT1_NONE);
+            pmt1Summary_[pmt0Entry].valid = 0;
+            pmt1Summary_[pmt0Entry].mapped = 0;
+            continue;
+        }
+
         bool pmt1UsedByOtherSegment = invalidateEntries(pmt0Entry, pmt1StartEntry, pmt1EndEntry, releaseResources);
 
         if (!pmt1UsedByOtherSegment)
         {
-            system_->pmtSpaceManager_.dealloc((PhysicalAddress)pmt0_[pmt0Entry].pmt1);
-            pmt0_[pmt0Entry].pmt1 = nullptr;
+            system_->retiredPmtFrames_.push_back((PhysicalAddress)pmt1Table(pmt0Entry));
+            PMT0_STORE(pmt0_[pmt0Entry].pmt1, PMT1_NONE);
         }
     }
 
     return OK;
 }
 
+// Releases everything the process holds in a single walk over its tables,
+// instead of deleting the segments one by one. Frames, clusters and PMT
+// frames are given back to their allocators in batches, once the memory
+// lock is released; Level 1 PMTs go through KernelSystem::reclaimPmtFrames(),
+// processes that used them before may still walk them. The TLB and the descriptors of private tables are not
+// cleared, nothing reaches them after the process is unregistered.
+void KernelProcess::teardown()
+{
+    // asynchronous page faults of the process still use it
+    system_->pageFaults_.cancel(this);
+
+    ReleasedResources released;
+    {
+        // the system lock keeps deleteSharedSegment() from disconnecting the process meanwhile
+        std::lock_guard<std::mutex> systemLock(system_->mutex_guard_);
+        std::lock_guard<std::mutex> lock(mutex_guard_);
+        std::lock_guard<std::mutex> memoryLock(system_->memory_guard_);
+
+        // pins the process did not release would keep the pages of other processes in memory for good
+        for (FrameNum frame = 0; pins_ > 0 && frame < system_->framePinners_.size(); ++frame)
+        {
+            std::vector<KernelProcess *> &pinners = system_->framePinners_[frame];
+            auto end = std::remove(pinners.begin(), pinners.end(), this);
+            system_->framePins_[frame] -= (unsigned int)(pinners.end() - end);
+            pins_ -= (unsigned int)(pinners.end() - end);
+            pinners.erase(end, pinners.end());
+        }
+
+        // shared segments the process is disconnected from, and whether it was the last process
+        std::vector<SharedSegmentDescr *> sharedSegments;
+        std::vector<bool> lastProcess;
+        auto disconnect = [&](unsigned int id) -> bool
+        {
+            SharedSegmentDescr *ssd = findSharedSegmentById(id);
+            auto it = std::find(sharedSegments.begin(), sharedSegments.end(), ssd);
+            if (it != sharedSegments.end())
+            {
+                return lastProcess[it - sharedSegments.begin()];
+            }
+
+            bool last = false;
+            if (ssd)
+            {
+                auto procPtr = std::find(ssd->processes_.begin(), ssd->processes_.end(), this);
+                if (procPtr != ssd->processes_.end())
+                {
+                    ssd->processes_.erase(procPtr);
+                    last = ssd->processes_.empty();
+                }
+            }
+            sharedSegments.push_back(ssd);
+            lastProcess.push_back(last);
+            return last;
+        };
+
+        for (int i = 0; i < PMT_0_NUM_ENTRIES; ++i)
+        {
+            unsigned int pmt1 = pmt0_[i].pmt1;
+            if (pmt1 == PMT1_NONE)
+            {
+                continue;
+            }
+
+            FrameNum table = PMT1_FRAME(pmt1);
+            if (PMT1_IS_COW(pmt1))
+            {
+                if (system_->pmtRefs_[table] > 1)
+                {
+                    leaveTable(i);
+                    continue;
+                }
+
+                // the other processes are gone, the table is released like a private one
+                system_->pmtRefs_[table] = 0;
+                system_->pmtProcesses_[table].clear();
+            }
+            else if (PMT1_IS_SHARED(pmt1))
+            {
+                disconnect(system_->pmtSharedSegments_[table]);
+                if (--system_->pmtRefs_[table] != 0)
+                {
+                    continue;
+                }
+            }
+
+            PmtEntry1 *pmt1Descrs = pmt1Table(i);
+            unsigned long long valid = pmt1Summary_[i].valid;
+            while (valid)
+            {
+                int j = maskLowestBit(valid);
+                valid &= valid - 1;
+                PmtEntry1 *descr = pmt1Descrs + j;
+
+                if (IS_COW_PAGE(FLAGS_LOAD(descr->flags)))
+                {
+                    releaseCowPage(descr->location, released);
+                }
+                else if (IS_SHARED_PAGE(FLAGS_LOAD(descr->flags)) && !PMT1_IS_SHARED(pmt1))
+                {
+                    // a shared page stays as it is while other processes are connected to the segment
+                    if (!disconnect(descr->location))
+                    {
+                        continue;
+                    }
+                    PmtEntry1 *page = sharedDescriptor(i, descr);
+                    collectPage(page, released);
+                    // back to the state of a new shared page, for the next process to connect
+                    BIT_CLEAR(page->flags, DESC_BIT_MAPPED | DESC_BIT_SWAPPED | DESC_BIT_DIRTY | DESC_BIT_REFERENCE);
+                    LOCATION_STORE(page->location, 0);
+                }
+                else
+                {
+                    collectPage(descr, released);
+                }
+            }
+
+            // processes that used the table before may still be walking it
+            system_->retiredPmtFrames_.push_back((PhysicalAddress)pmt1Descrs);
+            PMT0_STORE(pmt0_[i].pmt1, PMT1_NONE);
+        }
+
+        for (std::size_t k = 0; k < sharedSegments.size(); ++k)
+        {
+            if (lastProcess[k])
+            {
+                // shared level 1 PMTs were released with the last reference
+                std::fill(sharedSegments[k]->sharedPmt1s_.begin(), sharedSegments[k]->sharedPmt1s_.end(), PMT1_NONE);
+            }
+        }
+    }
+
+    released.pmtFrames_.push_back(pmt0_);
+    returnResources(released);
+    system_->reclaimPmtFrames();
+}
+
+// Clears what the system keeps about a frame that is given back, so that
+// nothing of it, a stale pin above all, passes to the next page in the frame.
+// Note: The caller has to hold memory_guard_.
+void KernelProcess::resetFrame(FrameNum frame)
+{
+    system_->framePins_[frame] = 0;
+    for (KernelProcess *pinner : system_->framePinners_[frame])
+    {
+        --pinner->pins_;
+    }
+    system_->framePinners_[frame].clear();
+    system_->frameOwners_[frame] = nullptr;
+    system_->framePages_[frame] = 0;
+}
+
+// Unlinks a page from page replacement and collects its frame and cluster.
+// Note: The caller has to hold memory_guard_.
+void KernelProcess::collectPage(PmtEntry1 *page, ReleasedResources &released)
+{
+    if (isInClock(page))
+    {
+        removeFromClock(page);
+    }
+    if (BIT_IS_SET(FLAGS_LOAD(page->flags), DESC_BIT_MAPPED)) // holds frame
+    {
+        FrameNum frame = page->location;
+        resetFrame(frame);
+        released.frames_.push_back((PhysicalAddress)((char *)system_->processSpace_ + frame * FRAME_SIZE));
+        if (BIT_IS_SET(FLAGS_LOAD(page->flags), DESC_BIT_SWAPPED)) // and a backing cluster on disk
+        {
+            released.clusters_.push_back(system_->frameClusters_[frame]);
+        }
+    }
+    else if (BIT_IS_SET(FLAGS_LOAD(page->flags), DESC_BIT_SWAPPED)) // holds cluster on disk
+    {
+        released.clusters_.push_back((ClusterNo)page->location);
+    }
+}
+
+// Gives collected frames and clusters back, taking each allocator's lock once.
+void KernelProcess::returnResources(ReleasedResources &released)
+{
+    if (!released.frames_.empty())
+    {
+        system_->processSpaceManager_.dealloc(released.frames_);
+    }
+    if (!released.clusters_.empty())
+    {
+        system_->diskSpaceManager_.freeClusters(released.clusters_);
+    }
+    if (!released.pmtFrames_.empty())
+    {
+        system_->pmtSpaceManager_.dealloc(released.pmtFrames_);
+    }
+}
+
 // for testing purposes
+void KernelProcess::getTlbStatistics(unsigned long &hits, unsigned long &misses) const
+{
+    hits = tlb_.getHits();
+    misses = tlb_.getMisses();
+}
+
 std::ostream &operator<<(std::ostream &os, const KernelProcess &kp)
 {
     os << "Process: (" << kp.pid_ << ")" << std::endl;
@@ -1065,7 +2658,7 @@ std::ostream &operator<<(std::ostream &os, const KernelProcess &kp)
     os << "  PMT1s: ";
     for (int i = 0; i < PMT_0_NUM_ENTRIES; ++i)
     {
-        if (kp.pmt0_[i].pmt1 != nullptr)
+        if (kp.pmt0_[i].pmt1 != PMT1_NONE)
         {
             os << i << " ";
         }
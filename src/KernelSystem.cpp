@@ -2,16 +2,26 @@
 // Summary: KernelSystem class implementation file.
 
 #include <algorithm>
+#include <chrono>
+#include <thread>
 #include "KernelSystem.h"
 #include "KernelProcess.h"
+#include "descr.h"
 #include "part.h"
 
 KernelSystem::KernelSystem(PhysicalAddress processVMSpace,
     PageNum processVMSpaceSize, PhysicalAddress pmtSpace,
     PageNum pmtSpaceSize, Partition *partition):
-    swapPartition_(partition),diskSpaceManager_((partition) ? partition->getNumOfClusters() : 0),
-    processSpaceManager_(processVMSpace, processVMSpaceSize), pmtSpaceManager_(pmtSpace, pmtSpaceSize),
-    processSpace_(processVMSpace), usedPids_(), nextUnusedPid_(0), pmtp_()
+    processSpaceManager_(processVMSpace, processVMSpaceSize), processSpace_(processVMSpace),
+    pmtSpaceManager_(pmtSpace, pmtSpaceSize), pmtSpace_(pmtSpace),
+    pmtRefs_(pmtSpaceSize), pmtProcesses_(pmtSpaceSize), pmtSharedSegments_(pmtSpaceSize), retiredPmtFrames_(),
+    diskSpaceManager_((partition) ? partition->getNumOfClusters() : 0), swapPartition_(partition),
+    frameClusters_(processVMSpaceSize), frameOwners_(processVMSpaceSize, nullptr), framePages_(processVMSpaceSize),
+    frameSharedIds_(processVMSpaceSize), framePins_(processVMSpaceSize), framePinners_(processVMSpaceSize),
+    cowPages_(), freeCowPages_(), frameDescrs_(processVMSpaceSize, nullptr),
+    sharedSegments_(), usedSharedSegmentIds_(), nextUnusedSharedSegmentId_(1), clockNext_(processVMSpaceSize, CLOCK_NO_FRAME),
+    clockPrev_(processVMSpaceSize, CLOCK_NO_FRAME), clockHand_(CLOCK_NO_FRAME), reclaimBatch_(1), nextUnusedPid_(0), usedPids_(), processTable_(),
+    thrashing_(false), faultRate_(0), pageFaults_()
 {
 
 }
@@ -51,7 +61,7 @@ KernelProcess *KernelSystem::createProcess()
 
     for (int i = 0; i < PMT_0_NUM_ENTRIES; ++i)
     {
-        pmt0[i].pmt1 = nullptr;
+        pmt0[i].pmt1 = PMT1_NONE;
     }
 
     // allocate the process
@@ -71,9 +81,13 @@ KernelProcess *KernelSystem::cloneProcess(ProcessId targetPid)
 {
     std::lock_guard<std::mutex> lock(mutex_guard_);
 
-    // find targeted process
-    auto it = pmtp_.find(targetPid);
-    if (it == pmtp_.end())
+    // find targeted process, it cannot be unregistered while the lock is held
+    KernelProcess *target;
+    {
+        ProcessTable::ReadSection section(processTable_);
+        target = processTable_.lookup(targetPid);
+    }
+    if (target == nullptr)
     {
         return nullptr; // no process with pid found
     }
@@ -94,7 +108,7 @@ KernelProcess *KernelSystem::cloneProcess(ProcessId targetPid)
         pid = nextUnusedPid_++;
     }
 
-    KernelProcess *newProcess = it->second->clone(pid);
+    KernelProcess *newProcess = target->clone(pid);
     if (!newProcess)
     {
         usedPids_.push(pid);
@@ -106,82 +120,143 @@ KernelProcess *KernelSystem::cloneProcess(ProcessId targetPid)
 
 Status KernelSystem::access(ProcessId pid, VirtualAddress address, AccessType type)
 {
-    if (!IS_VADDR_VALID(address))
+    PhysicalAddress physicalAddress;
+    return translate(pid, address, type, physicalAddress);
+}
+
+Status KernelSystem::translate(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress)
+{
+    // the process cannot be freed before the end of the read section
+    ProcessTable::ReadSection section(processTable_);
+    KernelProcess *proc = processTable_.lookup(pid);
+    if (proc == nullptr)
     {
-        return TRAP;
+        return TRAP; // no process with pid found
     }
 
-    auto it = pmtp_.find(pid);
-    if (it == pmtp_.end())
+    return proc->translate(address, type, out_physicalAddress);
+}
+
+// Page faults are serviced on the spot; the page may get evicted again
+// before the translation is retried, in which case it is faulted in again.
+Status KernelSystem::translateAndResolve(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress)
+{
+    ProcessReference reference(*this, pid);
+    KernelProcess *proc = reference.get();
+    if (proc == nullptr)
     {
         return TRAP; // no process with pid found
     }
 
-    PmtEntry0 *pmt0 = it->second->pmt0_;
-    int pmt0Entry = VADDR_PMT0_ENTRY(address);
-    int pmt1Entry = VADDR_PMT1_ENTRY(address);
-    int offset = VADDR_OFFSET(address);
-
-    if (pmt0[pmt0Entry].pmt1 == nullptr)
+    Status status;
+    while ((status = proc->translate(address, type, out_physicalAddress)) == PAGE_FAULT)
     {
-        return TRAP; // memory access violation
+        if (proc->pageFault(address) != OK)
+        {
+            return TRAP;
+        }
     }
-    if (!BIT_IS_SET(pmt0[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_VALID))
+    return status;
+}
+
+// Translates a batch of references of one process, servicing page faults on
+// the way: each round translates the whole batch and then services all page
+// faults at once, sorted by page. The physical addresses are valid only if no
+// page got evicted after the last round, so the batch has to fit in memory;
+// references still missing after TRANSLATE_BATCH_MAX_ROUNDS are left with
+// PAGE_FAULT status. Returns OK if every reference was translated.
+Status KernelSystem::translateBatch(ProcessId pid, const VirtualAddress *addresses, const AccessType *types,
+    unsigned int count, PhysicalAddress *out_physicalAddresses, Status *out_statuses)
+{
+    ProcessReference reference(*this, pid);
+    KernelProcess *proc = reference.get();
+    if (proc == nullptr)
     {
-        return TRAP; // memory access violation
+        return TRAP; // no process with pid found
     }
 
-    switch (type)
+    std::vector<VirtualAddress> faults;
+    Status ret;
+    for (unsigned int round = 0; ; ++round)
     {
-    case READ:
-        if (!BIT_IS_SET(pmt0[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_READ))
+        ret = OK;
+        faults.clear();
+        for (unsigned int i = 0; i < count; ++i)
         {
-            return TRAP; // memory access violation
+            out_statuses[i] = proc->translate(addresses[i], types[i], out_physicalAddresses[i]);
+            if (out_statuses[i] == PAGE_FAULT)
+            {
+                faults.push_back(addresses[i] & ~(VirtualAddress)(PAGE_SIZE - 1));
+            }
+            if (out_statuses[i] != OK)
+            {
+                ret = TRAP;
+            }
         }
-        break;
-    case WRITE:
-        if (!BIT_IS_SET(pmt0[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_WRITE))
+
+        if (faults.empty() || round == TRANSLATE_BATCH_MAX_ROUNDS)
         {
-            return TRAP; // memory access violation
+            return ret;
         }
-        break;
-    case READ_WRITE:
-        if (!BIT_IS_SET(pmt0[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_READ))
+
+        std::sort(faults.begin(), faults.end());
+        faults.erase(std::unique(faults.begin(), faults.end()), faults.end());
+        if (proc->pageFaults(faults.data(), faults.size()) != OK)
         {
-            return TRAP; // memory access violation
+            return TRAP;
         }
-        if (!BIT_IS_SET(pmt0[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_WRITE))
+    }
+}
+
+Time KernelSystem::periodicJob()
+{
+    std::lock_guard<std::mutex> lock(mutex_guard_);
+
+    // page fault rates over the last period, faults of suspended
+    // processes are already held back and do not count towards thrashing
+    unsigned long faults = 0;
+    for (KernelProcess *proc : processTable_.snapshot())
+    {
+        proc->faultRate_ = proc->faultsInPeriod_.exchange(0);
+        if (!proc->suspended_)
         {
-            return TRAP; // memory access violation
+            faults += proc->faultRate_;
         }
-        break;
-    case EXECUTE:
-        if (!BIT_IS_SET(pmt0[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_EXEC))
+        else
         {
-            return TRAP; // memory access violation
+            proc->swapOut(); // pages referenced before the last pass
         }
-        break;
-    default:
-        return TRAP; // invalid access type
-        break;
     }
+    FrameNum frames = processSpaceManager_.getFrameSpaceSize();
+    faultRate_ = (frames) ? faults * 100 / frames : 0;
 
-    if (!BIT_IS_SET(pmt0[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_MAPPED))
+    adaptFrameQuotas();
+
+    if (faultRate_ > LOAD_CONTROL_HIGH_WATERMARK)
     {
-        return PAGE_FAULT;
+        thrashing_ = true;
+        suspendProcess();
     }
-
-    if (type == WRITE || type == READ_WRITE)
+    else if (faultRate_ < LOAD_CONTROL_LOW_WATERMARK)
     {
-        BIT_SET(pmt0[pmt0Entry].pmt1[pmt1Entry].flags, DESC_BIT_DIRTY);
+        thrashing_ = false;
+        resumeProcess();
+        reclaimBatch_ = std::max<unsigned int>(reclaimBatch_ / 2, 1);
     }
 
-    return OK;
+    return PERIODIC_JOB_PERIOD;
 }
 
-Time KernelSystem::periodicJob()
+bool KernelSystem::isThrashing()
 {
-    return 0;
+    std::lock_guard<std::mutex> lock(mutex_guard_);
+    return thrashing_;
+}
+
+unsigned long KernelSystem::getPageFaultRate()
+{
+    std::lock_guard<std::mutex> lock(mutex_guard_);
+    return faultRate_;
 }
 
 ProcessId KernelSystem::getAvailablePid()
@@ -206,14 +281,167 @@ ProcessId KernelSystem::getAvailablePid()
     }
 }
 
+KernelSystem::ProcessReference::ProcessReference(KernelSystem &system, ProcessId pid):
+    proc_(nullptr)
+{
+    ProcessTable::ReadSection section(system.processTable_);
+    proc_ = system.processTable_.lookup(pid);
+    if (proc_)
+    {
+        ++proc_->references_;
+    }
+}
+
+KernelSystem::ProcessReference::~ProcessReference()
+{
+    if (proc_)
+    {
+        --proc_->references_;
+    }
+}
+
+KernelProcess *KernelSystem::ProcessReference::get() const
+{
+    return proc_;
+}
+
 void KernelSystem::registerProcess(KernelProcess *proc)
 {
-    pmtp_[proc->pid_] = proc;
+    processTable_.insert(proc->pid_, proc);
 }
 
+// Returns after all calls to access() that could have found the process
+// are done, so that the process can be torn down.
 void KernelSystem::unregisterProcess(KernelProcess *proc)
 {
+    {
+        std::lock_guard<std::mutex> lock(mutex_guard_);
+        processTable_.remove(proc->pid_);
+    }
+
+    // no new reference can be taken after this, the ones taken before are waited for
+    processTable_.synchronize();
+    while (proc->references_ != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_guard_);
     usedPids_.push(proc->pid_);
-    pmtp_.erase(proc->pid_);
+}
+
+// Frees the Level 1 PMTs retired so far, once the walks of translate() that
+// may still read them are done.
+// Note: The caller must not hold memory_guard_, the walks may wait for it.
+void KernelSystem::reclaimPmtFrames()
+{
+    std::vector<PhysicalAddress> frames;
+    {
+        std::lock_guard<std::mutex> memoryLock(memory_guard_);
+        frames.swap(retiredPmtFrames_);
+    }
+    if (frames.empty())
+    {
+        return;
+    }
+
+    processTable_.synchronize();
+    pmtSpaceManager_.dealloc(frames);
+}
+
+// Note: The caller has to hold mutex_guard_.
+void KernelSystem::adaptFrameQuotas()
+{
+    // suspended processes gave up their frames, only the running ones are committed
+    FrameNum frames = processSpaceManager_.getFrameSpaceSize();
+    FrameNum committed = 0;
+    std::vector<KernelProcess *> processes = processTable_.snapshot();
+    for (KernelProcess *proc : processes)
+    {
+        if (proc->suspended_)
+        {
+            continue;
+        }
+        if (proc->faultRate_ * 100 < PFF_LOWER_BOUND * proc->quota_ && proc->quota_ > PFF_MIN_QUOTA)
+        {
+            proc->quota_ = std::max<PageNum>(proc->quota_ - PFF_QUOTA_STEP, PFF_MIN_QUOTA);
+        }
+        committed += proc->quota_;
+    }
+
+    for (KernelProcess *proc : processes)
+    {
+        if (!proc->suspended_ && proc->faultRate_ * 100 > PFF_UPPER_BOUND * proc->quota_ && committed < frames)
+        {
+            PageNum step = std::min<PageNum>(PFF_QUOTA_STEP, frames - committed);
+            proc->quota_ += step;
+            committed += step;
+        }
+    }
+}
+
+// Suspends the process with the lowest priority (the one with the highest
+// page fault rate among those), so that the remaining processes can fit
+// their working sets in memory. Its private pages are swapped out by the
+// periodic job starting right away, a suspended process is not scheduled
+// and would keep them otherwise.
+// The last running process is never suspended.
+// Note: The caller has to hold mutex_guard_.
+void KernelSystem::suspendProcess()
+{
+    KernelProcess *target = nullptr;
+    unsigned running = 0;
+    for (KernelProcess *proc : processTable_.snapshot())
+    {
+        if (proc->suspended_)
+        {
+            continue;
+        }
+
+        ++running;
+        if (!target || proc->priority_ < target->priority_
+            || (proc->priority_ == target->priority_ && proc->faultRate_ > target->faultRate_))
+        {
+            target = proc;
+        }
+    }
+
+    if (running < 2)
+    {
+        return;
+    }
+
+    target->suspended_ = true;
+    target->swapOut();
+}
+
+// Resumes the suspended process with the highest priority.
+// Note: The caller has to hold mutex_guard_.
+void KernelSystem::resumeProcess()
+{
+    KernelProcess *target = nullptr;
+    for (KernelProcess *proc : processTable_.snapshot())
+    {
+        if (proc->suspended_ && (!target || proc->priority_ > target->priority_))
+        {
+            target = proc;
+        }
+    }
+
+    if (target)
+    {
+        target->suspended_ = false;
+        loadControl_.notify_all();
+    }
+}
+
+// Page faults of a suspended process are held back until the process is
+// resumed, but for no longer than one period, so that a client holding
+// its own locks while servicing a page fault cannot stall the system.
+void KernelSystem::waitIfSuspended(KernelProcess *proc)
+{
+    std::unique_lock<std::mutex> lock(mutex_guard_);
+    loadControl_.wait_for(lock, std::chrono::microseconds(PERIODIC_JOB_PERIOD),
+        [proc]() { return !proc->suspended_; });
 }
 
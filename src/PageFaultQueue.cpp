@@ -0,0 +1,95 @@
+// File: PageFaultQueue.cpp
+// Summary: PageFaultQueue class implementation file.
+
+#include <algorithm>
+#include "PageFaultQueue.h"
+#include "KernelProcess.h"
+
+PageFaultQueue::PageFaultQueue():
+    requests_(), running_(), workers_(), stopping_(false)
+{
+
+}
+
+// Processes cancel their faults when they are deleted, before the system,
+// so the queue is normally empty by now.
+PageFaultQueue::~PageFaultQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(guard_);
+        stopping_ = true;
+    }
+    queued_.notify_all();
+    for (auto &worker : workers_)
+    {
+        worker.join();
+    }
+
+    for (auto &request : requests_)
+    {
+        request.result_.set_value(TRAP);
+    }
+}
+
+std::future<Status> PageFaultQueue::push(KernelProcess *proc, VirtualAddress address)
+{
+    std::promise<Status> result;
+    std::future<Status> future = result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(guard_);
+        if (workers_.empty())
+        {
+            for (int i = 0; i < PAGE_FAULT_NUM_WORKERS; ++i)
+            {
+                workers_.push_back(std::thread(&PageFaultQueue::work, this));
+            }
+        }
+        requests_.push_back(Request{ proc, address, std::move(result) });
+    }
+    queued_.notify_one();
+    return future;
+}
+
+void PageFaultQueue::cancel(KernelProcess *proc)
+{
+    std::unique_lock<std::mutex> lock(guard_);
+    for (auto it = requests_.begin(); it != requests_.end(); )
+    {
+        if (it->proc_ == proc)
+        {
+            it->result_.set_value(TRAP);
+            it = requests_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    done_.wait(lock, [this, proc]() { return std::find(running_.begin(), running_.end(), proc) == running_.end(); });
+}
+
+void PageFaultQueue::work()
+{
+    std::unique_lock<std::mutex> lock(guard_);
+    for (;;)
+    {
+        queued_.wait(lock, [this]() { return stopping_ || !requests_.empty(); });
+        if (stopping_)
+        {
+            return;
+        }
+
+        Request request = std::move(requests_.front());
+        requests_.pop_front();
+        running_.push_back(request.proc_);
+
+        lock.unlock();
+        Status status = request.proc_->pageFault(request.address_);
+        request.result_.set_value(status);
+        lock.lock();
+
+        running_.erase(std::find(running_.begin(), running_.end(), request.proc_));
+        done_.notify_all();
+    }
+}
@@ -12,7 +12,7 @@ Process::Process(ProcessId pid):
 
 Process::~Process()
 {
-
+    delete pProcess;
 }
 
 ProcessId Process::getProcessId() const
@@ -42,11 +42,36 @@ Status Process::pageFault(VirtualAddress startAddress)
     return pProcess->pageFault(startAddress);
 }
 
+std::future<Status> Process::pageFaultAsync(VirtualAddress startAddress)
+{
+    return pProcess->pageFaultAsync(startAddress);
+}
+
 PhysicalAddress Process::getPhysicalAddress(VirtualAddress address)
 {
     return pProcess->getPhysicalAddress(address);
 }
 
+Status Process::read(VirtualAddress address, void *buffer, unsigned long length)
+{
+    return pProcess->read(address, buffer, length);
+}
+
+Status Process::write(VirtualAddress address, const void *buffer, unsigned long length)
+{
+    return pProcess->write(address, buffer, length);
+}
+
+Status Process::translateRange(VirtualAddress address, unsigned long length, AccessType type, std::vector<Extent> &out_extents)
+{
+    return pProcess->translateRange(address, length, type, out_extents);
+}
+
+Status Process::releaseRange(const std::vector<Extent> &extents)
+{
+    return pProcess->releaseRange(extents);
+}
+
 Process *Process::clone(ProcessId pid)
 {
     (void)pid; // ignore this parameter
@@ -79,7 +104,42 @@ Status Process::deleteSharedSegment(const char *name)
     return pProcess->deleteSharedSegment(name);
 }
 
+void Process::setPriority(unsigned int priority)
+{
+    pProcess->setPriority(priority);
+}
+
+unsigned int Process::getPriority() const
+{
+    return pProcess->getPriority();
+}
+
+unsigned long Process::getPageFaultRate() const
+{
+    return pProcess->getPageFaultRate();
+}
+
+bool Process::isSuspended() const
+{
+    return pProcess->isSuspended();
+}
+
+PageNum Process::getFrameQuota() const
+{
+    return pProcess->getFrameQuota();
+}
+
+PageNum Process::getResidentSetSize() const
+{
+    return pProcess->getResidentSetSize();
+}
+
 // for testing purposes
+void Process::getTlbStatistics(unsigned long &hits, unsigned long &misses) const
+{
+    pProcess->getTlbStatistics(hits, misses);
+}
+
 std::ostream & operator<<(std::ostream &os, const Process &p)
 {
     os << *p.pProcess;
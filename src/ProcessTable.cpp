@@ -0,0 +1,155 @@
+// File: ProcessTable.cpp
+// Summary: ProcessTable class implementation file.
+
+#include <algorithm>
+#include <thread>
+#include "ProcessTable.h"
+
+ProcessTable::Slots::Slots(ProcessId capacity):
+    capacity_(capacity), entries_(new std::atomic<KernelProcess *>[capacity]())
+{
+
+}
+
+ProcessTable::Slots::~Slots()
+{
+    delete[] entries_;
+}
+
+// The epoch is read again after the section is counted. If a synchronize()
+// flipped it in between, that call may have missed the count already, so
+// the section starts over in the new epoch.
+ProcessTable::ReadSection::ReadSection(const ProcessTable &table):
+    table_(table), slot_(ProcessTable::readerSlot()), epoch_(0)
+{
+    for (;;)
+    {
+        unsigned int epoch = table_.epoch_;
+        epoch_ = epoch & 1;
+        table_.readers_[slot_].active_[epoch_].fetch_add(1);
+        if (table_.epoch_ == epoch)
+        {
+            break;
+        }
+        table_.readers_[slot_].active_[epoch_].fetch_sub(1);
+    }
+}
+
+ProcessTable::ReadSection::~ReadSection()
+{
+    table_.readers_[slot_].active_[epoch_].fetch_sub(1);
+}
+
+ProcessTable::ProcessTable():
+    slots_(new Slots(PROCESS_TABLE_INITIAL_CAPACITY)), retired_(), epoch_(0)
+{
+    for (unsigned int i = 0; i < PROCESS_TABLE_NUM_READER_SLOTS; ++i)
+    {
+        readers_[i].active_[0] = 0;
+        readers_[i].active_[1] = 0;
+    }
+}
+
+ProcessTable::~ProcessTable()
+{
+    delete slots_.load();
+    for (Slots *slots : retired_)
+    {
+        delete slots;
+    }
+}
+
+// Note: Has to be called inside a read section.
+KernelProcess *ProcessTable::lookup(ProcessId pid) const
+{
+    Slots *slots = slots_.load();
+    if (pid >= slots->capacity_)
+    {
+        return nullptr;
+    }
+    return slots->entries_[pid].load();
+}
+
+void ProcessTable::insert(ProcessId pid, KernelProcess *proc)
+{
+    std::lock_guard<std::mutex> lock(writer_guard_);
+
+    Slots *slots = slots_.load();
+    if (pid >= slots->capacity_)
+    {
+        // grow the table; the caller may hold locks that readers wait for, so the
+        // old one is not freed here, but once no reader can be using it
+        Slots *newSlots = new Slots(std::max<ProcessId>(2 * slots->capacity_, pid + 1));
+        for (ProcessId i = 0; i < slots->capacity_; ++i)
+        {
+            newSlots->entries_[i] = slots->entries_[i].load();
+        }
+        slots_ = newSlots;
+        retired_.push_back(slots);
+        slots = newSlots;
+    }
+
+    slots->entries_[pid] = proc;
+}
+
+void ProcessTable::remove(ProcessId pid)
+{
+    std::lock_guard<std::mutex> lock(writer_guard_);
+
+    Slots *slots = slots_.load();
+    if (pid < slots->capacity_)
+    {
+        slots->entries_[pid] = nullptr;
+    }
+}
+
+// Waits for all read sections that started before the call to end, and
+// frees the tables that were replaced before it.
+void ProcessTable::synchronize()
+{
+    std::lock_guard<std::mutex> lock(epoch_guard_);
+
+    std::vector<Slots *> retired;
+    {
+        std::lock_guard<std::mutex> writerLock(writer_guard_);
+        retired.swap(retired_);
+    }
+
+    unsigned int previous = epoch_.fetch_add(1) & 1;
+    for (unsigned int i = 0; i < PROCESS_TABLE_NUM_READER_SLOTS; ++i)
+    {
+        while (readers_[i].active_[previous] != 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    for (Slots *slots : retired)
+    {
+        delete slots;
+    }
+}
+
+std::vector<KernelProcess *> ProcessTable::snapshot() const
+{
+    ReadSection section(*this);
+
+    std::vector<KernelProcess *> ret;
+    Slots *slots = slots_.load();
+    for (ProcessId i = 0; i < slots->capacity_; ++i)
+    {
+        KernelProcess *proc = slots->entries_[i].load();
+        if (proc)
+        {
+            ret.push_back(proc);
+        }
+    }
+    return ret;
+}
+
+unsigned int ProcessTable::readerSlot()
+{
+    static std::atomic<unsigned int> nextSlot(0);
+    static thread_local unsigned int slot = nextSlot++ % PROCESS_TABLE_NUM_READER_SLOTS;
+    return slot;
+}
@@ -6,8 +6,26 @@
 
 SharedSegmentDescr::SharedSegmentDescr(VirtualAddress va, PageNum size,
     unsigned int id, const char *name, AccessType rights):
-    startAddr_(va), size_(size), id_(id), name_(name), rights_(rights), processes_()
+    id_(id), name_(name), startAddr_(va), size_(size), rights_(rights), processes_(), dying_(false), pages_(size)
 {
-
+    PageNum firstPage = va >> BITS_IN_VADDR_OFFSET;
+    PageNum endPage = firstPage + size;
+    firstSharedPmt0Entry_ = (firstPage + PMT_1_NUM_ENTRIES - 1) / PMT_1_NUM_ENTRIES;
+    unsigned int endSharedPmt0Entry = endPage / PMT_1_NUM_ENTRIES;
+    if (endSharedPmt0Entry > firstSharedPmt0Entry_)
+    {
+        sharedPmt1s_.assign(endSharedPmt0Entry - firstSharedPmt0Entry_, PMT1_NONE);
+    }
 }
 
+
+// Returns the shared Level 1 PMT for the Level 0 PMT entry, nullptr if the
+// segment does not cover the whole table.
+unsigned int *SharedSegmentDescr::sharedPmt1(unsigned int pmt0Entry)
+{
+    if (pmt0Entry < firstSharedPmt0Entry_ || pmt0Entry - firstSharedPmt0Entry_ >= sharedPmt1s_.size())
+    {
+        return nullptr;
+    }
+    return &sharedPmt1s_[pmt0Entry - firstSharedPmt0Entry_];
+}
@@ -0,0 +1,79 @@
+// File: SharedSegmentRegistry.cpp
+// Summary: SharedSegmentRegistry class implementation file.
+
+#include "SharedSegmentRegistry.h"
+#include "SharedSegmentDescr.h"
+
+SharedSegmentRegistry::SharedSegmentRegistry():
+    byId_(), byAddress_(), byName_()
+{
+
+}
+
+SharedSegmentRegistry::~SharedSegmentRegistry()
+{
+
+}
+
+SharedSegmentDescr *SharedSegmentRegistry::findById(unsigned int id) const
+{
+    if (id >= byId_.size())
+    {
+        return nullptr;
+    }
+    return byId_[id];
+}
+
+SharedSegmentDescr *SharedSegmentRegistry::findByName(const char *name) const
+{
+    auto it = byName_.find(name);
+    if (it == byName_.end())
+    {
+        return nullptr;
+    }
+    return byId_[it->second];
+}
+
+// Segments in the registry do not overlap, so only the segment starting
+// right before the range and the one starting right after its start can.
+bool SharedSegmentRegistry::overlaps(VirtualAddress startAddr, PageNum size) const
+{
+    VirtualAddress endAddr = startAddr + size * PAGE_SIZE - 1;
+
+    auto next = byAddress_.lower_bound(startAddr);
+    if (next != byAddress_.end() && next->first <= endAddr)
+    {
+        return true;
+    }
+
+    if (next != byAddress_.begin())
+    {
+        SharedSegmentDescr *prev = std::prev(next)->second;
+        if (prev->startAddr_ + prev->size_ * PAGE_SIZE - 1 >= startAddr)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Note: The caller has to make sure that the segment does not overlap others
+//       and that its id and name are not in use.
+void SharedSegmentRegistry::insert(SharedSegmentDescr *descr)
+{
+    if (descr->id_ >= byId_.size())
+    {
+        byId_.resize(descr->id_ + 1, nullptr);
+    }
+    byId_[descr->id_] = descr;
+    byAddress_[descr->startAddr_] = descr;
+    byName_[descr->name_] = descr->id_;
+}
+
+void SharedSegmentRegistry::remove(SharedSegmentDescr *descr)
+{
+    byId_[descr->id_] = nullptr;
+    byAddress_.erase(descr->startAddr_);
+    byName_.erase(descr->name_);
+}
@@ -57,3 +57,29 @@ Status System::access(ProcessId pid, VirtualAddress address, AccessType type)
     return pSystem->access(pid, address, type);
 }
 
+Status System::translate(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress)
+{
+    return pSystem->translate(pid, address, type, out_physicalAddress);
+}
+
+Status System::translateAndResolve(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress &out_physicalAddress)
+{
+    return pSystem->translateAndResolve(pid, address, type, out_physicalAddress);
+}
+
+Status System::translateBatch(ProcessId pid, const VirtualAddress *addresses, const AccessType *types, unsigned int count,
+    PhysicalAddress *out_physicalAddresses, Status *out_statuses)
+{
+    return pSystem->translateBatch(pid, addresses, types, count, out_physicalAddresses, out_statuses);
+}
+
+bool System::isThrashing()
+{
+    return pSystem->isThrashing();
+}
+
+unsigned long System::getPageFaultRate()
+{
+    return pSystem->getPageFaultRate();
+}
+
@@ -0,0 +1,127 @@
+// File: Tlb.cpp
+// Summary: Tlb class implementation file.
+
+#include "Tlb.h"
+#include "descr.h"
+
+#define TLB_FLAGS_MASK 0xffULL
+#define TLB_PAGE_SHIFT 8
+#define TLB_PAGE_MASK 0x00ffffffULL
+#define TLB_FRAME_SHIFT 32
+
+Tlb::Tlb():
+    nextStamp_(0), hits_(0), misses_(0)
+{
+    for (int i = 0; i < TLB_NUM_ENTRIES; ++i)
+    {
+        entries_[i] = 0;
+    }
+}
+
+bool Tlb::lookup(PageNum page, unsigned int requiredFlags, FrameNum &out_frame)
+{
+    Entry entry = entries_[page % TLB_NUM_ENTRIES].load();
+    unsigned int flags = (unsigned int)(entry & TLB_FLAGS_MASK);
+    requiredFlags |= TLB_BIT_VALID;
+
+    if (((entry >> TLB_PAGE_SHIFT) & TLB_PAGE_MASK) != page || (flags & requiredFlags) != requiredFlags)
+    {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    out_frame = (FrameNum)(entry >> TLB_FRAME_SHIFT);
+    return true;
+}
+
+// The stamp leaves the valid bit clear, so it never matches in lookup().
+Tlb::Entry Tlb::newStamp()
+{
+    return (nextStamp_.fetch_add(1) + 1) << TLB_PAGE_SHIFT;
+}
+
+Tlb::Entry Tlb::reserve(PageNum page)
+{
+    Entry stamp = newStamp();
+    entries_[page % TLB_NUM_ENTRIES].store(stamp);
+    return stamp;
+}
+
+void Tlb::insert(PageNum page, FrameNum frame, unsigned int flags, Entry stamp)
+{
+    Entry entry = ((Entry)frame << TLB_FRAME_SHIFT)
+        | (((Entry)page & TLB_PAGE_MASK) << TLB_PAGE_SHIFT)
+        | ((Entry)(flags | TLB_BIT_VALID) & TLB_FLAGS_MASK);
+
+    // the stamp is gone if the slot was invalidated or reserved again meanwhile,
+    // the translation may be stale then and is dropped
+    entries_[page % TLB_NUM_ENTRIES].compare_exchange_strong(stamp, entry);
+}
+
+void Tlb::invalidate(PageNum page)
+{
+    entries_[page % TLB_NUM_ENTRIES].store(newStamp());
+}
+
+void Tlb::flush()
+{
+    for (int i = 0; i < TLB_NUM_ENTRIES; ++i)
+    {
+        entries_[i].store(newStamp());
+    }
+}
+
+unsigned int Tlb::flagsFromDescriptor(unsigned int descrFlags)
+{
+    unsigned int flags = 0;
+    if (BIT_IS_SET(descrFlags, DESC_BIT_READ))
+    {
+        flags |= TLB_BIT_READ;
+    }
+    if (BIT_IS_SET(descrFlags, DESC_BIT_WRITE))
+    {
+        flags |= TLB_BIT_WRITE;
+    }
+    if (BIT_IS_SET(descrFlags, DESC_BIT_EXEC))
+    {
+        flags |= TLB_BIT_EXEC;
+    }
+    if (BIT_IS_SET(descrFlags, DESC_BIT_DIRTY))
+    {
+        flags |= TLB_BIT_DIRTY;
+    }
+    if (BIT_IS_SET(descrFlags, DESC_BIT_REFERENCE))
+    {
+        flags |= TLB_BIT_REFERENCE;
+    }
+    return flags;
+}
+
+// A write hits in the TLB only if the dirty bit is already set in the descriptor.
+unsigned int Tlb::flagsRequiredFor(AccessType type)
+{
+    switch (type)
+    {
+    case READ:
+        return TLB_BIT_READ;
+    case WRITE:
+        return TLB_BIT_WRITE | TLB_BIT_DIRTY;
+    case READ_WRITE:
+        return TLB_BIT_READ | TLB_BIT_WRITE | TLB_BIT_DIRTY;
+    case EXECUTE:
+        return TLB_BIT_EXEC;
+    default:
+        return ~0U; // never hits
+    }
+}
+
+unsigned long Tlb::getHits() const
+{
+    return hits_;
+}
+
+unsigned long Tlb::getMisses() const
+{
+    return misses_;
+}
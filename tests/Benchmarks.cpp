@@ -0,0 +1,625 @@
+// File: Benchmarks.cpp
+// Summary: Benchmark functions.
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <future>
+
+#include "Benchmarks.h"
+#include "part.h"
+#include "Process.h"
+#include "System.h"
+#include "Tlb.h"
+
+// Runs access() + getPhysicalAddress() over the pages and returns the average
+// time of one translation in nanoseconds.
+static double timeTranslations(System &system, Process *proc, const VirtualAddress *pages, int numPages, int rounds)
+{
+    ProcessId pid = proc->getProcessId();
+    volatile char sink = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (int i = 0; i < numPages; ++i)
+        {
+            if (system.access(pid, pages[i], READ) != OK) exit(42);
+            sink = *(char *)proc->getPhysicalAddress(pages[i]);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    (void)sink;
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / ((double)rounds * numPages);
+}
+
+void benchmarkTlb()
+{
+    const int numPages = 8;
+    const int rounds = 100000;
+    char *frameSpace = new char[2 * numPages * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 2 * numPages, pmtSpace, 100, &swap);
+    Process *proc = system.createProcess();
+
+    // pages that fall into different TLB entries, and pages that all fall into
+    // the same one and keep evicting each other
+    VirtualAddress hot[numPages], conflicting[numPages];
+    for (int i = 0; i < numPages; ++i)
+    {
+        hot[i] = (VirtualAddress)i << BITS_IN_VADDR_OFFSET;
+        conflicting[i] = (VirtualAddress)(TLB_NUM_ENTRIES * (i + 1)) << BITS_IN_VADDR_OFFSET;
+        proc->createSegment(hot[i], 1, READ_WRITE);
+        proc->createSegment(conflicting[i], 1, READ_WRITE);
+    }
+    for (int i = 0; i < numPages; ++i)
+    {
+        if (system.access(proc->getProcessId(), hot[i], READ) == PAGE_FAULT) proc->pageFault(hot[i]);
+        if (system.access(proc->getProcessId(), conflicting[i], READ) == PAGE_FAULT) proc->pageFault(conflicting[i]);
+    }
+
+    unsigned long hits0, misses0, hits1, misses1, hits2, misses2;
+    proc->getTlbStatistics(hits0, misses0);
+    double hotTime = timeTranslations(system, proc, hot, numPages, rounds);
+    proc->getTlbStatistics(hits1, misses1);
+    double conflictingTime = timeTranslations(system, proc, conflicting, numPages, rounds);
+    proc->getTlbStatistics(hits2, misses2);
+
+    std::cout << "TLB benchmark, " << numPages << " pages, " << rounds << " rounds" << std::endl;
+    std::cout << "Hot pages:         " << hotTime << " ns/translation, hit rate "
+        << 100.0 * (hits1 - hits0) / (hits1 - hits0 + misses1 - misses0) << "%" << std::endl;
+    std::cout << "Conflicting pages: " << conflictingTime << " ns/translation, hit rate "
+        << 100.0 * (hits2 - hits1) / (hits2 - hits1 + misses2 - misses1) << "%" << std::endl;
+    std::cout << "Speedup: " << conflictingTime / hotTime << "x" << std::endl;
+
+    delete proc;
+    delete[] pmtSpace;
+    delete[] frameSpace;
+}
+
+// Every reader thread keeps accessing a page of its own process for the
+// given time, while the churn thread (if any) keeps creating and destroying
+// processes. Returns the number of accesses per second of all readers.
+static double measureAccessThroughput(System &system, Process **readers, int numReaders,
+    bool churn, unsigned long &processesChurned)
+{
+    const std::chrono::milliseconds duration(500);
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long> accesses(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numReaders; ++i)
+    {
+        threads.push_back(std::thread([&system, &stop, &accesses, readers, i]()
+        {
+            ProcessId pid = readers[i]->getProcessId();
+            unsigned long count = 0;
+            while (!stop)
+            {
+                if (system.access(pid, 0x00000000, READ) != OK) exit(42);
+                ++count;
+            }
+            accesses += count;
+        }));
+    }
+
+    processesChurned = 0;
+    std::thread churnThread;
+    if (churn)
+    {
+        churnThread = std::thread([&system, &stop, &processesChurned]()
+        {
+            while (!stop)
+            {
+                Process *proc = system.createProcess();
+                if (proc == nullptr) exit(42);
+                proc->createSegment(0x00000000, 1, READ_WRITE);
+                if (system.access(proc->getProcessId(), 0x00000000, WRITE) == PAGE_FAULT)
+                {
+                    proc->pageFault(0x00000000);
+                }
+                delete proc;
+                ++processesChurned;
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    if (churn)
+    {
+        churnThread.join();
+    }
+
+    return accesses * 1000.0 / duration.count();
+}
+
+void benchmarkProcessTable()
+{
+    const int numReaders = 4;
+    char *frameSpace = new char[64 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 64, pmtSpace, 100, &swap);
+    Process *readers[numReaders];
+    for (int i = 0; i < numReaders; ++i)
+    {
+        readers[i] = system.createProcess();
+        readers[i]->createSegment(0x00000000, 1, READ_WRITE);
+        if (system.access(readers[i]->getProcessId(), 0x00000000, READ) == PAGE_FAULT)
+        {
+            readers[i]->pageFault(0x00000000);
+        }
+    }
+
+    unsigned long churned;
+    double quiet = measureAccessThroughput(system, readers, numReaders, false, churned);
+    double churning = measureAccessThroughput(system, readers, numReaders, true, churned);
+
+    std::cout << "Process table benchmark, " << numReaders << " reader threads" << std::endl;
+    std::cout << "No churn:   " << quiet << " accesses/s" << std::endl;
+    std::cout << "With churn: " << churning << " accesses/s, "
+        << churned << " processes created and destroyed" << std::endl;
+
+    for (int i = 0; i < numReaders; ++i)
+    {
+        delete readers[i];
+    }
+    delete[] pmtSpace;
+    delete[] frameSpace;
+}
+
+// Instructions of a few references each, with some locality: every instruction
+// stays within a window of pages that slowly moves through the segment.
+static void generateInstructions(std::vector<VirtualAddress> &addresses, std::vector<AccessType> &types,
+    int numInstructions, int referencesPerInstruction, PageNum segmentSize)
+{
+    srand(42);
+    for (int i = 0; i < numInstructions; ++i)
+    {
+        PageNum window = (i / 64) % (segmentSize - 8);
+        for (int j = 0; j < referencesPerInstruction; ++j)
+        {
+            PageNum page = window + rand() % 8;
+            addresses.push_back(page * PAGE_SIZE + rand() % PAGE_SIZE);
+            types.push_back((rand() % 2) ? READ : WRITE);
+        }
+    }
+}
+
+void benchmarkTranslateBatch()
+{
+    const int numInstructions = 200000;
+    const int referencesPerInstruction = 8;
+    const PageNum segmentSize = 128;
+    char *frameSpace = new char[32 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 32, pmtSpace, 100, &swap);
+    Process *proc = system.createProcess();
+    ProcessId pid = proc->getProcessId();
+    proc->createSegment(0x00000000, segmentSize, READ_WRITE);
+
+    std::vector<VirtualAddress> addresses;
+    std::vector<AccessType> types;
+    generateInstructions(addresses, types, numInstructions, referencesPerInstruction, segmentSize);
+
+    // one address at a time, the way SystemTest::doInstruction() used to
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < addresses.size(); ++i)
+    {
+        if (i % (1000 * referencesPerInstruction) == 0)
+        {
+            system.periodicJob();
+        }
+        if (system.access(pid, addresses[i], types[i]) == PAGE_FAULT)
+        {
+            if (proc->pageFault(addresses[i]) != OK) exit(42);
+            if (system.access(pid, addresses[i], types[i]) != OK) exit(42);
+        }
+        *(char *)proc->getPhysicalAddress(addresses[i]) = 'A';
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double perAddress = std::chrono::duration<double>(end - start).count();
+
+    // one instruction at a time, one address at a time if the instruction
+    // does not fit in the frame quota of the process
+    PhysicalAddress physicalAddresses[referencesPerInstruction];
+    Status statuses[referencesPerInstruction];
+    unsigned long fallbacks = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < addresses.size(); i += referencesPerInstruction)
+    {
+        if (i % (1000 * referencesPerInstruction) == 0)
+        {
+            system.periodicJob();
+        }
+        if (system.translateBatch(pid, &addresses[i], &types[i], referencesPerInstruction,
+            physicalAddresses, statuses) == OK)
+        {
+            for (int j = 0; j < referencesPerInstruction; ++j)
+            {
+                *(char *)physicalAddresses[j] = 'A';
+            }
+            continue;
+        }
+
+        ++fallbacks;
+        for (int j = 0; j < referencesPerInstruction; ++j)
+        {
+            if (system.translateAndResolve(pid, addresses[i + j], types[i + j], physicalAddresses[j]) != OK) exit(42);
+            *(char *)physicalAddresses[j] = 'A';
+        }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    double batched = std::chrono::duration<double>(end - start).count();
+
+    std::cout << "Translate batch benchmark, " << numInstructions << " instructions of "
+        << referencesPerInstruction << " references" << std::endl;
+    std::cout << "Per address: " << addresses.size() / perAddress << " references/s" << std::endl;
+    std::cout << "Batched:     " << addresses.size() / batched << " references/s, "
+        << fallbacks << " instructions fell back to single references" << std::endl;
+    std::cout << "Speedup: " << perAddress / batched << "x" << std::endl;
+
+    delete proc;
+    delete[] pmtSpace;
+    delete[] frameSpace;
+}
+
+void benchmarkClone()
+{
+    const PageNum segmentSize = 1000;
+    const int rounds = 100;
+    char *frameSpace = new char[512 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 512, pmtSpace, 100, &swap);
+    Process *proc = system.createProcess();
+    proc->createSegment(0x00000000, segmentSize, READ_WRITE);
+
+    // half of the pages in memory, the other half swapped out
+    char page[PAGE_SIZE] = { 'A' };
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        if (proc->write(i * PAGE_SIZE, page, PAGE_SIZE) != OK) exit(42);
+    }
+
+    double cloneTime = 0, writeTime = 0;
+    for (int round = 0; round < rounds; ++round)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        Process *child = system.cloneProcess(proc->getProcessId());
+        auto end = std::chrono::high_resolution_clock::now();
+        if (child == nullptr) exit(42);
+        cloneTime += std::chrono::duration<double, std::micro>(end - start).count();
+
+        // the first write to a page after the clone pays for the copy
+        start = std::chrono::high_resolution_clock::now();
+        if (child->write(0x00000000, page, 1) != OK) exit(42);
+        end = std::chrono::high_resolution_clock::now();
+        writeTime += std::chrono::duration<double, std::micro>(end - start).count();
+
+        delete child;
+    }
+
+    std::cout << "Clone benchmark, " << segmentSize << " pages" << std::endl;
+    std::cout << "Clone:       " << cloneTime / rounds << " us" << std::endl;
+    std::cout << "First write: " << writeTime / rounds << " us" << std::endl;
+
+    delete proc;
+    delete[] pmtSpace;
+    delete[] frameSpace;
+}
+
+// Every thread keeps touching random pages of its own process for the given
+// time. Together the pages touched do not fit in memory, so most references
+// fault and evict pages of other processes. Returns the number of page
+// faults serviced per second by all threads.
+static double measureFaultThroughput(System &system, Process **procs, int numThreads, PageNum segmentSize)
+{
+    const std::chrono::milliseconds duration(500);
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long> faults(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i)
+    {
+        threads.push_back(std::thread([&system, &stop, &faults, procs, i, segmentSize]()
+        {
+            Process *proc = procs[i];
+            ProcessId pid = proc->getProcessId();
+            unsigned int seed = i;
+            unsigned long count = 0;
+            while (!stop)
+            {
+                seed = seed * 1103515245 + 12345;
+                VirtualAddress address = (seed >> 8) % segmentSize * PAGE_SIZE;
+                AccessType type = (seed & 0x10000) ? READ : WRITE;
+                if (system.access(pid, address, type) == PAGE_FAULT)
+                {
+                    if (proc->pageFault(address) != OK) exit(42);
+                    ++count;
+                }
+            }
+            faults += count;
+        }));
+    }
+
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    return faults * 1000.0 / duration.count();
+}
+
+void benchmarkConcurrentFaults()
+{
+    const int maxThreads = 8;
+    const PageNum segmentSize = 96;
+    char *frameSpace = new char[64 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    std::cout << "Concurrent page fault benchmark, " << segmentSize << " pages per process, 64 frames" << std::endl;
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        Partition swap("p1.ini");
+        System system(frameSpace, 64, pmtSpace, 100, &swap);
+        Process *procs[maxThreads];
+        for (int i = 0; i < numThreads; ++i)
+        {
+            procs[i] = system.createProcess();
+            procs[i]->createSegment(0x00000000, segmentSize, READ_WRITE);
+        }
+
+        double faults = measureFaultThroughput(system, procs, numThreads, segmentSize);
+        std::cout << numThreads << " threads: " << faults << " faults/s" << std::endl;
+
+        for (int i = 0; i < numThreads; ++i)
+        {
+            delete procs[i];
+        }
+    }
+
+    delete[] pmtSpace;
+    delete[] frameSpace;
+}
+
+void benchmarkSharedFaults()
+{
+    const int maxThreads = 8;
+    const PageNum segmentSize = 16;
+    char *frameSpace = new char[8 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    // the threads fault on the same few pages, a page is read in once for
+    // all the threads waiting for it
+    std::cout << "Shared segment page fault benchmark, " << segmentSize << " shared pages, 8 frames" << std::endl;
+    for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        Partition swap("p1.ini");
+        System system(frameSpace, 8, pmtSpace, 100, &swap);
+        Process *procs[maxThreads];
+        for (int i = 0; i < numThreads; ++i)
+        {
+            procs[i] = system.createProcess();
+            if (procs[i]->createSharedSegment(0x00000000, segmentSize, "benchmark", READ_WRITE) != OK) exit(42);
+        }
+
+        double faults = measureFaultThroughput(system, procs, numThreads, segmentSize);
+        std::cout << numThreads << " threads: " << faults << " faults/s" << std::endl;
+
+        procs[0]->deleteSharedSegment("benchmark");
+        for (int i = 0; i < numThreads; ++i)
+        {
+            delete procs[i];
+        }
+    }
+
+    delete[] pmtSpace;
+    delete[] frameSpace;
+}
+
+// A partition on a disk that takes its time, like a real one.
+class SlowPartition: public Partition {
+public:
+    SlowPartition(const char *name, std::chrono::microseconds latency): Partition(name), latency_(latency) {}
+
+    int readCluster(ClusterNo cluster, char *buffer) override
+    {
+        std::this_thread::sleep_for(latency_);
+        return Partition::readCluster(cluster, buffer);
+    }
+
+    int writeCluster(ClusterNo cluster, const char *buffer) override
+    {
+        std::this_thread::sleep_for(latency_);
+        return Partition::writeCluster(cluster, buffer);
+    }
+
+private:
+    std::chrono::microseconds latency_;
+};
+
+// A scheduler that drives the processes from one host thread, each process
+// running its own stream of random references. On a page fault the blocking
+// scheduler services the fault on the spot; the asynchronous one starts it
+// and runs other processes until the page is in memory. Returns the number
+// of references per second of all the processes.
+static double runScheduler(System &system, Process **procs, int numProcs, PageNum segmentSize,
+    int referencesPerProcess, bool async)
+{
+    struct Task {
+        unsigned int seed;
+        int done;
+        std::future<Status> fault;
+    };
+
+    std::vector<Task> tasks(numProcs);
+    for (int i = 0; i < numProcs; ++i)
+    {
+        tasks[i].seed = i;
+        tasks[i].done = 0;
+    }
+
+    int finished = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    while (finished < numProcs)
+    {
+        Task *waiting = nullptr;
+        bool ran = false;
+        for (int i = 0; i < numProcs; ++i)
+        {
+            Task &task = tasks[i];
+            if (task.done == referencesPerProcess)
+            {
+                continue;
+            }
+            if (task.fault.valid())
+            {
+                if (task.fault.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                {
+                    waiting = &task; // still waiting for the page
+                    continue;
+                }
+                if (task.fault.get() != OK) exit(42);
+            }
+            ran = true;
+
+            // run the process until its next page fault
+            while (task.done < referencesPerProcess)
+            {
+                unsigned int next = task.seed * 1103515245 + 12345;
+                VirtualAddress address = (next >> 8) % segmentSize * PAGE_SIZE;
+                AccessType type = (next & 0x10000) ? READ : WRITE;
+                Status status = system.access(procs[i]->getProcessId(), address, type);
+                if (status == PAGE_FAULT)
+                {
+                    if (async)
+                    {
+                        task.fault = procs[i]->pageFaultAsync(address);
+                        break;
+                    }
+                    if (procs[i]->pageFault(address) != OK) exit(42);
+                    continue;
+                }
+                if (status != OK) exit(42);
+                task.seed = next;
+                ++task.done;
+            }
+            if (task.done == referencesPerProcess)
+            {
+                ++finished;
+            }
+        }
+
+        // every process waits for a page, so does the scheduler
+        if (!ran && waiting)
+        {
+            waiting->fault.wait();
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    return (double)numProcs * referencesPerProcess / std::chrono::duration<double>(end - start).count();
+}
+
+void benchmarkAsyncScheduler()
+{
+    const int numProcs = 16;
+    const PageNum segmentSize = 64;
+    const int referencesPerProcess = 2000;
+    const std::chrono::microseconds latency(100);
+    char *frameSpace = new char[128 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    double throughput[2];
+    for (int async = 0; async < 2; ++async)
+    {
+        SlowPartition swap("p1.ini", latency);
+        System system(frameSpace, 128, pmtSpace, 100, &swap);
+        Process *procs[numProcs];
+        for (int i = 0; i < numProcs; ++i)
+        {
+            procs[i] = system.createProcess();
+            procs[i]->createSegment(0x00000000, segmentSize, READ_WRITE);
+        }
+
+        throughput[async] = runScheduler(system, procs, numProcs, segmentSize, referencesPerProcess, async != 0);
+
+        for (int i = 0; i < numProcs; ++i)
+        {
+            delete procs[i];
+        }
+    }
+
+    std::cout << "Scheduler benchmark, " << numProcs << " processes of " << segmentSize
+        << " pages on one thread, 128 frames, " << latency.count() << " us disk latency" << std::endl;
+    std::cout << "Blocking faults:     " << throughput[0] << " references/s" << std::endl;
+    std::cout << "Asynchronous faults: " << throughput[1] << " references/s" << std::endl;
+    std::cout << "Speedup: " << throughput[1] / throughput[0] << "x" << std::endl;
+
+    delete[] pmtSpace;
+    delete[] frameSpace;
+}
+
+void benchmarkProcessExit()
+{
+    const PageNum segmentSize = 16;
+    const int numSegments = 500;
+    const int rounds = 20;
+    char *frameSpace = new char[8192 * FRAME_SIZE];
+    char *pmtSpace = new char[512 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 8192, pmtSpace, 512, &swap);
+
+    // many small segments in two processes that take turns faulting pages in,
+    // so the frames of the one that exits are scattered over the memory
+    double exitTime = 0;
+    for (int round = 0; round < rounds; ++round)
+    {
+        Process *procs[2];
+        for (int p = 0; p < 2; ++p)
+        {
+            procs[p] = system.createProcess();
+            for (int s = 0; s < numSegments; ++s)
+            {
+                if (procs[p]->createSegment(s * segmentSize * PAGE_SIZE, segmentSize, READ_WRITE) != OK) exit(42);
+            }
+        }
+        char c = 'A';
+        for (PageNum i = 0; i < numSegments * segmentSize; ++i)
+        {
+            if (procs[0]->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+            if (procs[1]->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        delete procs[0];
+        auto end = std::chrono::high_resolution_clock::now();
+        exitTime += std::chrono::duration<double, std::micro>(end - start).count();
+        delete procs[1];
+    }
+
+    std::cout << "Process exit benchmark, " << numSegments << " segments of " << segmentSize << " pages" << std::endl;
+    std::cout << "Exit: " << exitTime / rounds << " us" << std::endl;
+
+    delete[] pmtSpace;
+    delete[] frameSpace;
+}
@@ -0,0 +1,16 @@
+// File: Benchmarks.h
+// Summary: Benchmark function prototypes.
+
+#ifndef VM_EMU_BENCHMARKS_H
+#define VM_EMU_BENCHMARKS_H
+
+void benchmarkTlb();
+void benchmarkProcessTable();
+void benchmarkTranslateBatch();
+void benchmarkClone();
+void benchmarkConcurrentFaults();
+void benchmarkSharedFaults();
+void benchmarkAsyncScheduler();
+void benchmarkProcessExit();
+
+#endif // VM_EMU_BENCHMARKS_H
@@ -10,6 +10,10 @@ SystemTest::SystemTest(System &system_, void *processVMSpace, PageNum processVMS
 Status SystemTest::doInstruction(Process &process,
                                  const std::vector<std::tuple<VirtualAddress, AccessType, char>> addresses,
                                 ProcessTest &processTest) {
+    if (doInstructionBatched(process, addresses, processTest)) {
+        return OK;
+    }
+
     for (auto iter = addresses.begin(); iter != addresses.end(); iter++) {
         AccessType accessType = std::get<1>(*iter);
         VirtualAddress address = std::get<0>(*iter);
@@ -61,6 +65,50 @@ Status SystemTest::doInstruction(Process &process,
     return OK;
 }
 
+// Translates all addresses of the instruction at once. Returns false without
+// touching memory if any of them could not be translated.
+bool SystemTest::doInstructionBatched(Process &process,
+                                      const std::vector<std::tuple<VirtualAddress, AccessType, char>> &addresses,
+                                      ProcessTest &processTest) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    std::vector<VirtualAddress> virtualAddresses;
+    std::vector<AccessType> accessTypes;
+    for (auto iter = addresses.begin(); iter != addresses.end(); iter++) {
+        virtualAddresses.push_back(std::get<0>(*iter));
+        accessTypes.push_back(std::get<1>(*iter));
+    }
+
+    std::vector<PhysicalAddress> physicalAddresses(addresses.size());
+    std::vector<Status> statuses(addresses.size());
+    if (system.translateBatch(process.getProcessId(), virtualAddresses.data(), accessTypes.data(),
+                              addresses.size(), physicalAddresses.data(), statuses.data()) != OK) {
+        return false;
+    }
+
+    for (size_t i = 0; i < addresses.size(); i++) {
+        VirtualAddress address = std::get<0>(addresses[i]);
+        char expectedValue = std::get<2>(addresses[i]);
+        PhysicalAddress pa = physicalAddresses[i];
+        checkAddress(pa);
+        switch (std::get<1>(addresses[i])) {
+            case READ:
+            case EXECUTE: {
+                char value = *(char *) pa;
+                processTest.checkValue(address, expectedValue);
+                break;
+            }
+            case WRITE: {
+                *(char *) pa = expectedValue;
+                processTest.markDirty(address);
+                break;
+            }
+            default: break;
+        }
+    }
+    return true;
+}
+
 void SystemTest::checkAddress(void *address) const {
     assert(address);
     assert(address >= beginSpace);
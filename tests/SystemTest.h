@@ -18,6 +18,8 @@ public:
                          ProcessTest &processTest);
     std::mutex& getGlobalMutex();
 private:
+    bool doInstructionBatched(Process &process, const std::vector<std::tuple<VirtualAddress, AccessType, char>> &addresses,
+                              ProcessTest &processTest);
     void checkAddress(void *address) const;
     std::mutex mutex;
     System& system;
@@ -4,36 +4,22 @@
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "tests.h"
 #include "descr.h"
 #include "part.h"
 #include "Process.h"
 #include "System.h"
+#include "KernelSystem.h"
 #include "FrameAllocator.h"
-
-void testDescriptorSize()
-{
-    std::cout << "PMT0 Descriptor" << std::endl;
-    std::cout << "Size: " << sizeof(PmtEntry0) << "B" << std::endl;
-    std::cout << "Alignment: " << alignof(PmtEntry0) << "B" << std::endl;
-    std::cout << std::endl;
-
-    std::cout << "PMT0 Table" << std::endl;
-    std::cout << "Number of entries: " << PMT_0_NUM_ENTRIES << std::endl;
-    std::cout << "Size: " << PMT_0_NUM_ENTRIES * sizeof(PmtEntry0) << "B" << std::endl;
-    std::cout << std::endl;
-
-    std::cout << "PMT1 Descriptor" << std::endl;
-    std::cout << "Size: " << sizeof(PmtEntry1) << "B" << std::endl;
-    std::cout << "Alignment: " << alignof(PmtEntry1) << "B" << std::endl;
-    std::cout << std::endl;
-
-    std::cout << "PMT1 Table" << std::endl;
-    std::cout << "Number of entries: " << PMT_1_NUM_ENTRIES << std::endl;
-    std::cout << "Size: " << PMT_1_NUM_ENTRIES * sizeof(PmtEntry1) << "B" << std::endl;
-    std::cout << std::endl;
-}
+#include "Tlb.h"
 
 void testSegmentAllocation()
 {
@@ -404,3 +390,1465 @@ void Test_06()
 
 }
 
+void Test_07()
+{
+    char *frameSpace = new char[10 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 10, pmtSpace, 100, &swap);
+    PhysicalAddress pa;
+    const int nproc = 4;
+    const PageNum segmentSize = 8;
+    const int passes = 10; // over its working set, for a process to complete
+    const int maxPeriods = 200;
+    Process *proc[nproc] = { 0 };
+    int passesLeft[nproc];
+    bool wasSuspended[nproc];
+    for (int i = 0; i < nproc; ++i)
+    {
+        proc[i] = system.createProcess();
+        proc[i]->setPriority(i);
+        proc[i]->createSegment(0x00000000, segmentSize, READ_WRITE);
+        passesLeft[i] = passes;
+        wasSuspended[i] = false;
+    }
+
+    // working sets of all processes together do not fit in memory
+    int running = nproc;
+    bool suspended = false;
+    bool relieved = false;
+    for (int round = 0; running > 0; ++round)
+    {
+        if (round == maxPeriods) exit(42); // a suspended process was never resumed
+
+        for (int i = 0; i < nproc; ++i)
+        {
+            if (!proc[i] || proc[i]->isSuspended())
+            {
+                continue; // scheduler does not run suspended processes
+            }
+
+            VirtualAddress addr = 0x00000000;
+            for (PageNum page = 0; page < segmentSize; ++page, addr += PAGE_SIZE)
+            {
+                if (system.access(proc[i]->getProcessId(), addr, WRITE) == PAGE_FAULT)
+                {
+                    proc[i]->pageFault(addr);
+                    if (system.access(proc[i]->getProcessId(), addr, WRITE) != OK) exit(42);
+                }
+                pa = proc[i]->getPhysicalAddress(addr);
+                *(char *)pa = 'A' + i;
+            }
+
+            if (--passesLeft[i] == 0)
+            {
+                delete proc[i];
+                proc[i] = nullptr;
+                --running;
+            }
+        }
+
+        system.periodicJob();
+        unsigned long rate = system.getPageFaultRate();
+        if (rate > LOAD_CONTROL_HIGH_WATERMARK && !system.isThrashing()) exit(42);
+        if (rate < LOAD_CONTROL_LOW_WATERMARK && system.isThrashing()) exit(42);
+        if (suspended && rate < LOAD_CONTROL_HIGH_WATERMARK)
+        {
+            relieved = true;
+        }
+        for (int i = 0; i < nproc; ++i)
+        {
+            if (proc[i] && proc[i]->isSuspended())
+            {
+                // a suspended process gives up its frames by the end of the next period, pages it
+                // referenced get a second chance; all but the page of its last fault
+                if (wasSuspended[i] && proc[i]->getResidentSetSize() > 1) exit(42);
+                suspended = true;
+            }
+            wasSuspended[i] = proc[i] && proc[i]->isSuspended();
+        }
+    }
+
+    // suspending processes brought the fault rate down, and all the suspended ones completed
+    if (!suspended || !relieved) exit(42);
+    std::cout << "OK" << std::endl;
+}
+
+void Test_08()
+{
+    char *frameSpace = new char[4 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 4, pmtSpace, 100, &swap);
+    PhysicalAddress pa, pa2;
+    const PageNum segmentSize = 16;
+    Process *proc = system.createProcess();
+    ProcessId pid = proc->getProcessId();
+    proc->createSegment(0x00000000, segmentSize, READ_WRITE);
+    proc->createSegment(0x00010000, 1, READ);
+
+    // a page that is not in memory
+    if (system.translate(pid, 0x00000000, WRITE, pa) != PAGE_FAULT) exit(42);
+
+    // every page gets faulted in, memory only holds four of them
+    VirtualAddress addr = 0x00000000;
+    for (PageNum page = 0; page < segmentSize; ++page, addr += PAGE_SIZE)
+    {
+        if (system.translateAndResolve(pid, addr + page, WRITE, pa) != OK) exit(42);
+        *(char *)pa = 'a' + page;
+
+        // same translation as the old interface
+        if (system.translate(pid, addr + page, READ, pa2) != OK) exit(42);
+        if (pa2 != pa || proc->getPhysicalAddress(addr + page) != pa) exit(42);
+    }
+
+    addr = 0x00000000;
+    for (PageNum page = 0; page < segmentSize; ++page, addr += PAGE_SIZE)
+    {
+        if (system.translateAndResolve(pid, addr + page, READ, pa) != OK) exit(42);
+        std::cout << *(char *)pa;
+    }
+    std::cout << std::endl;
+
+    // access violations
+    if (system.translateAndResolve(pid, 0x00010000, WRITE, pa) != TRAP) exit(42);
+    if (system.translateAndResolve(pid, 0x00020000, READ, pa) != TRAP) exit(42);
+    if (system.translate(pid + 1, 0x00000000, READ, pa) != TRAP) exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete proc;
+}
+
+void Test_09()
+{
+    char *frameSpace = new char[4 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 4, pmtSpace, 100, &swap);
+    const PageNum segmentSize = 16;
+    const unsigned long length = 10 * PAGE_SIZE + 123;
+    Process *proc = system.createProcess();
+    proc->createSegment(0x00000000, segmentSize, READ_WRITE);
+    proc->createSegment(0x00010000, 1, READ);
+
+    // copy does not fit in memory and does not start at a page boundary
+    char *in = new char[length];
+    char *out = new char[length];
+    for (unsigned long i = 0; i < length; ++i)
+    {
+        in[i] = 'a' + i % 26;
+    }
+    if (proc->write(PAGE_SIZE + 100, in, length) != OK) exit(42);
+    if (proc->read(PAGE_SIZE + 100, out, length) != OK) exit(42);
+    if (memcmp(in, out, length) != 0) exit(42);
+
+    // same bytes through the old interface
+    VirtualAddress addr = PAGE_SIZE + 100 + 5 * PAGE_SIZE;
+    if (system.access(proc->getProcessId(), addr, READ) == PAGE_FAULT)
+    {
+        proc->pageFault(addr);
+        if (system.access(proc->getProcessId(), addr, READ) != OK) exit(42);
+    }
+    if (*(char *)proc->getPhysicalAddress(addr) != in[5 * PAGE_SIZE]) exit(42);
+
+    // access violations
+    if (proc->write(0x00010000, in, 1) != TRAP) exit(42);
+    if (proc->read(segmentSize * PAGE_SIZE - 10, out, 20) != TRAP) exit(42);
+    if (proc->read(0x00010000, out, PAGE_SIZE) != OK) exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete[] out;
+    delete[] in;
+    delete proc;
+}
+
+void Test_10()
+{
+    char *frameSpace = new char[4 * FRAME_SIZE];
+    char *pmtSpace = new char[100 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 4, pmtSpace, 100, &swap);
+    const PageNum segmentSize = 16;
+    Process *proc = system.createProcess();
+    proc->createSegment(0x00000000, segmentSize, READ_WRITE);
+
+    // three pages, the range does not start at a page boundary
+    std::vector<Extent> extents;
+    const unsigned long length = 2 * PAGE_SIZE + 200;
+    if (proc->translateRange(PAGE_SIZE + 100, length, WRITE, extents) != OK) exit(42);
+    unsigned long total = 0;
+    for (const Extent &extent : extents)
+    {
+        memset(extent.address_, 'x', extent.length_);
+        total += extent.length_;
+    }
+    if (total != length) exit(42);
+    std::cout << "Extents: " << extents.size() << std::endl;
+
+    // pinned pages survive a pass over the rest of the segment
+    char buffer[PAGE_SIZE];
+    for (VirtualAddress addr = 4 * PAGE_SIZE; addr < segmentSize * PAGE_SIZE; addr += PAGE_SIZE)
+    {
+        if (proc->read(addr, buffer, PAGE_SIZE) != OK) exit(42);
+    }
+    for (const Extent &extent : extents)
+    {
+        for (unsigned long i = 0; i < extent.length_; ++i)
+        {
+            if (((char *)extent.address_)[i] != 'x') exit(42);
+        }
+    }
+
+    // written through the extents, read through the page tables
+    proc->releaseRange(extents);
+    char *out = new char[length];
+    if (proc->read(PAGE_SIZE + 100, out, length) != OK) exit(42);
+    for (unsigned long i = 0; i < length; ++i)
+    {
+        if (out[i] != 'x') exit(42);
+    }
+
+    // nothing can be evicted when every frame is pinned
+    std::vector<Extent> more;
+    if (proc->translateRange(0x00000000, 4 * PAGE_SIZE, READ, extents) != OK) exit(42);
+    if (proc->translateRange(8 * PAGE_SIZE, 1, READ, more) != TRAP) exit(42);
+    proc->releaseRange(extents);
+    if (proc->translateRange(8 * PAGE_SIZE, 1, READ, more) != OK) exit(42);
+    proc->releaseRange(more);
+    std::cout << "OK" << std::endl;
+
+    delete[] out;
+    delete proc;
+}
+
+void Test_11()
+{
+    std::cout << "PMT0 Descriptor: " << sizeof(PmtEntry0) << "B, alignment " << alignof(PmtEntry0) << "B" << std::endl;
+    std::cout << "PMT0 Table: " << PMT_0_NUM_ENTRIES << " entries, " << PMT_0_NUM_ENTRIES * sizeof(PmtEntry0) << "B" << std::endl;
+    std::cout << "PMT1 Descriptor: " << sizeof(PmtEntry1) << "B, alignment " << alignof(PmtEntry1) << "B" << std::endl;
+    std::cout << "PMT1 Table: " << PMT_1_NUM_ENTRIES << " entries, " << PMT_1_NUM_ENTRIES * sizeof(PmtEntry1) << "B" << std::endl;
+
+    // the same on 32-bit and 64-bit hosts
+    if (sizeof(PmtEntry0) != 4 || alignof(PmtEntry0) != 4) exit(42);
+    if (sizeof(PmtEntry1) != 8 || alignof(PmtEntry1) != 4) exit(42);
+    if (PMT_0_NUM_ENTRIES * sizeof(PmtEntry0) > FRAME_SIZE) exit(42);
+    if (PMT_1_NUM_ENTRIES * sizeof(PmtEntry1) > FRAME_SIZE) exit(42);
+
+    // one frame per table: a level 0 and a level 1 PMT for a single page
+    char *frameSpace = new char[4 * FRAME_SIZE];
+    char *pmtSpace = new char[2 * FRAME_SIZE];
+    Partition swap("p1.ini");
+    System system(frameSpace, 4, pmtSpace, 2, &swap);
+    Process *proc = system.createProcess();
+    if (proc->createSegment(0x00000000, 1, READ_WRITE) != OK) exit(42);
+    if (proc->createSegment(0x00010000, 1, READ_WRITE) != TRAP) exit(42);
+    char c = 'x';
+    if (proc->write(0x00000000, &c, 1) != OK) exit(42);
+    if (proc->read(0x00000000, &c, 1) != OK || c != 'x') exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete proc;
+}
+
+void Test_12()
+{
+    // PMT0 and three PMT1s for the first process, PMT0 and the partially
+    // covered PMT1 for every other one: fits only if the rest are shared
+    char *frameSpace = new char[8 * FRAME_SIZE];
+    char *pmtSpace = new char[8 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 8, pmtSpace, 8, &swap);
+    const VirtualAddress start = 0x00010000;
+    const PageNum segmentSize = 2 * PMT_1_NUM_ENTRIES + 10;
+    Process *a = system.createProcess();
+    Process *b = system.createProcess();
+    if (a->createSharedSegment(start, segmentSize, "shm", READ_WRITE) != OK) exit(42);
+    if (b->createSharedSegment(start, segmentSize, "shm", READ_WRITE) != OK) exit(42);
+
+    // written by one process, read by the other, with most pages evicted in between
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        char c = 'a' + i % 26;
+        if (a->write(start + i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        char c;
+        if (b->read(start + i * PAGE_SIZE, &c, 1) != OK || c != 'a' + i % 26) exit(42);
+    }
+
+    Process *clone = system.cloneProcess(a->getProcessId());
+    if (clone == nullptr) exit(42);
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        char c;
+        if (clone->read(start + i * PAGE_SIZE, &c, 1) != OK || c != 'a' + i % 26) exit(42);
+    }
+
+    // the shared tables stay with the processes still connected
+    if (b->disconnectSharedSegment("shm") != OK) exit(42);
+    if (system.access(b->getProcessId(), start, READ) != TRAP) exit(42);
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        char c;
+        if (a->read(start + i * PAGE_SIZE, &c, 1) != OK || c != 'a' + i % 26) exit(42);
+    }
+
+    // a private segment cannot take over a part of a shared table
+    if (a->createSegment(start + PMT_1_NUM_ENTRIES * PAGE_SIZE, 1, READ_WRITE) != TRAP) exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete clone;
+    delete b;
+    delete a;
+}
+
+void Test_13()
+{
+    char *frameSpace = new char[16 * FRAME_SIZE];
+    char *pmtSpace = new char[8 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 16, pmtSpace, 8, &swap);
+    Process *a = system.createProcess();
+    Process *b = system.createProcess();
+
+    // one single page segment per page of a level 1 PMT
+    for (PageNum i = 0; i < PMT_1_NUM_ENTRIES; ++i)
+    {
+        std::string name = "shm" + std::to_string(i);
+        char c = 'a' + i % 26;
+        if (a->createSharedSegment(i * PAGE_SIZE, 1, name.c_str(), READ_WRITE) != OK) exit(42);
+        if (b->createSharedSegment(i * PAGE_SIZE, 1, name.c_str(), READ_WRITE) != OK) exit(42);
+        if (a->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+    for (PageNum i = 0; i < PMT_1_NUM_ENTRIES; ++i)
+    {
+        char c;
+        if (b->read(i * PAGE_SIZE, &c, 1) != OK || c != 'a' + i % 26) exit(42);
+    }
+
+    // neighbours on both sides are overlap checked
+    if (a->createSharedSegment(10 * PAGE_SIZE, 1, "other", READ_WRITE) != TRAP) exit(42);
+    if (a->createSharedSegment(PMT_1_NUM_ENTRIES * PAGE_SIZE - PAGE_SIZE, 2, "other", READ_WRITE) != TRAP) exit(42);
+
+    // a deleted segment frees its name, range and id
+    if (a->deleteSharedSegment("shm10") != OK) exit(42);
+    if (b->disconnectSharedSegment("shm10") != TRAP) exit(42);
+    if (system.access(b->getProcessId(), 10 * PAGE_SIZE, READ) != TRAP) exit(42);
+    if (b->createSharedSegment(10 * PAGE_SIZE, 1, "other", READ_WRITE) != OK) exit(42);
+    if (a->createSharedSegment(10 * PAGE_SIZE, 1, "other", READ_WRITE) != OK) exit(42);
+    char c = 'x';
+    if (b->write(10 * PAGE_SIZE, &c, 1) != OK) exit(42);
+    if (a->read(10 * PAGE_SIZE, &c, 1) != OK || c != 'x') exit(42);
+    if (a->read(11 * PAGE_SIZE, &c, 1) != OK || c != 'l') exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete b;
+    delete a;
+}
+
+void Test_14()
+{
+    // more shared segments than the ids in the old descriptor format allowed
+    const PageNum segments = 1100;
+    char *frameSpace = new char[16 * FRAME_SIZE];
+    char *pmtSpace = new char[64 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 16, pmtSpace, 64, &swap);
+    Process *a = system.createProcess();
+    Process *b = system.createProcess();
+
+    for (PageNum i = 0; i < segments; ++i)
+    {
+        std::string name = "shm" + std::to_string(i);
+        char c = 'a' + i % 26;
+        if (a->createSharedSegment(i * PAGE_SIZE, 1, name.c_str(), READ_WRITE) != OK) exit(42);
+        if (b->createSharedSegment(i * PAGE_SIZE, 1, name.c_str(), READ_WRITE) != OK) exit(42);
+        if (a->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+
+    // most pages were evicted in between, the data has to come back from swap
+    for (PageNum i = 0; i < segments; ++i)
+    {
+        char c;
+        if (b->read(i * PAGE_SIZE, &c, 1) != OK || c != 'a' + i % 26) exit(42);
+    }
+
+    Process *clone = system.cloneProcess(b->getProcessId());
+    if (clone == nullptr) exit(42);
+    char c = 'x';
+    if (clone->write((segments - 1) * PAGE_SIZE, &c, 1) != OK) exit(42);
+    if (a->read((segments - 1) * PAGE_SIZE, &c, 1) != OK || c != 'x') exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete clone;
+    delete b;
+    delete a;
+}
+
+void Test_15()
+{
+    // more pages than frames, so that the clone shares both frames and clusters
+    const PageNum segmentSize = 3 * PMT_1_NUM_ENTRIES;
+    char *frameSpace = new char[64 * FRAME_SIZE];
+    char *pmtSpace = new char[32 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 64, pmtSpace, 32, &swap);
+    Process *parent = system.createProcess();
+    if (parent->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+    if (parent->createSegment(0x00040000, 1, READ) != OK) exit(42);
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        char c = 'a' + i % 26;
+        if (parent->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+
+    // the pages in memory now belong to both processes, not to the parent
+    Process *child = system.cloneProcess(parent->getProcessId());
+    if (child == nullptr) exit(42);
+    if (parent->getResidentSetSize() != 0 || child->getResidentSetSize() != 0) exit(42);
+
+    // a write gives the writer its own copy, the other process keeps the old one
+    for (PageNum i = 0; i < segmentSize; i += 2)
+    {
+        char c = 'A' + i % 26;
+        if (child->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        char c;
+        if (parent->read(i * PAGE_SIZE, &c, 1) != OK || c != 'a' + i % 26) exit(42);
+        if (child->read(i * PAGE_SIZE, &c, 1) != OK || c != (i % 2 ? 'a' : 'A') + i % 26) exit(42);
+    }
+
+    // a read-only page is never copied
+    char c;
+    if (child->read(0x00040000, &c, 1) != OK) exit(42);
+    if (system.access(child->getProcessId(), 0x00040000, WRITE) != TRAP) exit(42);
+
+    // the pages left to the child alone are taken over, not copied
+    delete parent;
+    for (PageNum i = 1; i < segmentSize; i += 2)
+    {
+        c = 'A' + i % 26;
+        if (child->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        if (child->read(i * PAGE_SIZE, &c, 1) != OK || c != 'A' + i % 26) exit(42);
+    }
+    std::cout << "OK" << std::endl;
+
+    delete child;
+}
+
+void Test_16()
+{
+    // room for the tables of the template and the level 0 tables of the
+    // clones, and a few more tables
+    const int numClones = 20;
+    const PageNum segmentSize = 4 * PMT_1_NUM_ENTRIES;
+    const PageNum pagesInMemory = 8;
+    char *frameSpace = new char[64 * FRAME_SIZE];
+    char *pmtSpace = new char[(numClones + 10) * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 64, pmtSpace, numClones + 10, &swap);
+    Process *parent = system.createProcess();
+    if (parent->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+    if (parent->createSegment(segmentSize * PAGE_SIZE, 1, READ) != OK) exit(42);
+    for (PageNum i = 0; i < segmentSize; i += PMT_1_NUM_ENTRIES)
+    {
+        for (PageNum j = i; j < i + pagesInMemory; ++j)
+        {
+            char c = 'a' + j % 26;
+            if (parent->write(j * PAGE_SIZE, &c, 1) != OK) exit(42);
+        }
+    }
+
+    Process *clones[numClones];
+    for (int i = 0; i < numClones; ++i)
+    {
+        clones[i] = system.cloneProcess(parent->getProcessId());
+        if (clones[i] == nullptr) exit(42);
+    }
+
+    // a write copies only the table of the page
+    for (int i = 0; i < 3; ++i)
+    {
+        char c = 'A' + i;
+        if (clones[i]->write(i * PMT_1_NUM_ENTRIES * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+    for (PageNum i = 0; i < segmentSize; i += PMT_1_NUM_ENTRIES)
+    {
+        for (PageNum j = i; j < i + pagesInMemory; ++j)
+        {
+            char c;
+            if (parent->read(j * PAGE_SIZE, &c, 1) != OK || c != 'a' + j % 26) exit(42);
+            if (clones[numClones - 1]->read(j * PAGE_SIZE, &c, 1) != OK || c != 'a' + j % 26) exit(42);
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        char c;
+        PageNum page = i * PMT_1_NUM_ENTRIES;
+        if (clones[i]->read(page * PAGE_SIZE, &c, 1) != OK || c != 'A' + i) exit(42);
+        if (clones[i]->read((page + 1) * PAGE_SIZE, &c, 1) != OK || c != 'a' + (page + 1) % 26) exit(42);
+    }
+
+    // a page that can not be written is loaded without copying its table
+    for (int i = 0; i < numClones; ++i)
+    {
+        char c;
+        if (clones[i]->read(segmentSize * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+
+    // deleting a segment leaves the table to the other processes
+    if (clones[3]->deleteSegment(0x00000000) != OK) exit(42);
+    if (system.access(clones[3]->getProcessId(), 0x00000000, READ) != TRAP) exit(42);
+
+    delete parent;
+    for (int i = 0; i < numClones; ++i)
+    {
+        char c;
+        PageNum page = segmentSize - PMT_1_NUM_ENTRIES + pagesInMemory - 1;
+        if (i != 3 && (clones[i]->read(page * PAGE_SIZE, &c, 1) != OK || c != 'a' + page % 26)) exit(42);
+        delete clones[i];
+    }
+    std::cout << "OK" << std::endl;
+}
+
+void Test_17()
+{
+    const PageNum pinnedPages = 4;
+    char *frameSpace = new char[16 * FRAME_SIZE];
+    char *pmtSpace = new char[32 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 16, pmtSpace, 32, &swap);
+    Process *parent = system.createProcess();
+    if (parent->createSegment(0x00000000, 2 * PMT_1_NUM_ENTRIES, READ_WRITE) != OK) exit(42);
+    std::vector<Extent> extents;
+    if (parent->translateRange(0x00000000, pinnedPages * PAGE_SIZE, WRITE, extents) != OK) exit(42);
+    for (PageNum i = 0; i < pinnedPages; ++i)
+    {
+        char c = 'a' + i;
+        if (parent->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+
+    // pinned pages are copied to free frames, the clone has them in memory
+    Process *child = system.cloneProcess(parent->getProcessId());
+    if (child == nullptr) exit(42);
+    if (child->getResidentSetSize() != pinnedPages) exit(42);
+
+    // with the memory full, pinned pages may have to go through the disk
+    for (PageNum i = PMT_1_NUM_ENTRIES; i < 2 * PMT_1_NUM_ENTRIES; ++i)
+    {
+        char c = 'A';
+        if (parent->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+    Process *child2 = system.cloneProcess(parent->getProcessId());
+    if (child2 == nullptr) exit(42);
+
+    // the frames stay pinned for the parent, writes through them are private
+    for (const Extent &extent : extents)
+    {
+        memset(extent.address_, 'z', extent.length_);
+    }
+    for (PageNum i = 0; i < pinnedPages; ++i)
+    {
+        char c;
+        if (child->read(i * PAGE_SIZE, &c, 1) != OK || c != 'a' + i) exit(42);
+        if (child2->read(i * PAGE_SIZE, &c, 1) != OK || c != 'a' + i) exit(42);
+        if (parent->read(i * PAGE_SIZE, &c, 1) != OK || c != 'z') exit(42);
+    }
+    if (parent->releaseRange(extents) != OK) exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete child2;
+    delete child;
+    delete parent;
+}
+
+void Test_18()
+{
+    const PageNum segmentSize = 16;
+    char *frameSpace = new char[4 * FRAME_SIZE];
+    char *pmtSpace = new char[16 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 4, pmtSpace, 16, &swap);
+    Process *p = system.createProcess();
+    if (p->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+
+    // the faults of all pages are started at once, each completes on its own
+    std::vector<std::future<Status>> faults;
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        if (system.access(p->getProcessId(), i * PAGE_SIZE, WRITE) != PAGE_FAULT) exit(42);
+    }
+    for (PageNum i = 0; i < segmentSize; ++i)
+    {
+        faults.push_back(p->pageFaultAsync(i * PAGE_SIZE));
+    }
+    for (auto &fault : faults)
+    {
+        if (fault.get() != OK) exit(42);
+    }
+
+    // with more pages than frames the faults evict each other, the page awaited last is in memory
+    std::future<Status> fault = p->pageFaultAsync(0x00000000);
+    if (fault.get() != OK) exit(42);
+    if (system.access(p->getProcessId(), 0x00000000, WRITE) != OK) exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete p;
+}
+
+void Test_19()
+{
+    // Systems do not share any state, segments of the same name in different
+    // systems are different segments. Every page fits in memory, so the swap
+    // partition is never used and all the systems can be given the same one.
+    const int numSystems = 4;
+    const PageNum segmentSize = 2 * PMT_1_NUM_ENTRIES;
+    Partition swap("p1.ini");
+    std::vector<std::thread> threads;
+    for (int s = 0; s < numSystems; ++s)
+    {
+        threads.push_back(std::thread([&swap, s, segmentSize]()
+        {
+            char *frameSpace = new char[4 * segmentSize * FRAME_SIZE];
+            char *pmtSpace = new char[32 * FRAME_SIZE];
+            System system(frameSpace, 4 * segmentSize, pmtSpace, 32, &swap);
+
+            for (int round = 0; round < 50; ++round)
+            {
+                Process *writer = system.createProcess();
+                Process *reader = system.createProcess();
+                if (writer->createSharedSegment(0x00000000, segmentSize, "shared", READ_WRITE) != OK) exit(42);
+                if (reader->createSharedSegment(0x00000000, segmentSize, "shared", READ_WRITE) != OK) exit(42);
+                if (writer->createSegment(segmentSize * PAGE_SIZE, segmentSize, READ_WRITE) != OK) exit(42);
+
+                char c = 'a' + s;
+                for (PageNum i = 0; i < segmentSize; ++i)
+                {
+                    if (writer->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+                    if (writer->write((segmentSize + i) * PAGE_SIZE, &c, 1) != OK) exit(42);
+                }
+
+                Process *child = system.cloneProcess(writer->getProcessId());
+                if (child == nullptr) exit(42);
+                for (PageNum i = 0; i < segmentSize; ++i)
+                {
+                    char r;
+                    if (reader->read(i * PAGE_SIZE, &r, 1) != OK || r != c) exit(42);
+                    if (child->read((segmentSize + i) * PAGE_SIZE, &r, 1) != OK || r != c) exit(42);
+                }
+
+                if (writer->deleteSharedSegment("shared") != OK) exit(42);
+                delete child;
+                delete reader;
+                delete writer;
+            }
+
+            delete[] pmtSpace;
+            delete[] frameSpace;
+        }));
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    std::cout << "OK" << std::endl;
+}
+
+void Test_20()
+{
+    // Exiting processes give back their frames, clusters and tables. The
+    // rounds swap out more pages than the partition has clusters for, and
+    // each round needs most of the PMT space, so nothing may be left behind.
+    const PageNum segmentSize = 2 * PMT_1_NUM_ENTRIES;
+    const VirtualAddress sharedStart = segmentSize * PAGE_SIZE;
+    const PageNum sharedSize = PMT_1_NUM_ENTRIES;
+    char *frameSpace = new char[16 * FRAME_SIZE];
+    char *pmtSpace = new char[8 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 16, pmtSpace, 8, &swap);
+    Process *reader = system.createProcess();
+    if (reader->createSharedSegment(sharedStart, sharedSize, "shared", READ_WRITE) != OK) exit(42);
+    for (int round = 0; round < 300; ++round)
+    {
+        Process *parent = system.createProcess();
+        if (parent->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+        if (parent->createSharedSegment(sharedStart, sharedSize, "shared", READ_WRITE) != OK) exit(42);
+        char c = 'a' + round % 26;
+        for (PageNum i = 0; i < segmentSize; ++i)
+        {
+            if (parent->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+        }
+        for (PageNum i = 0; i < sharedSize; ++i)
+        {
+            if (parent->write(sharedStart + i * PAGE_SIZE, &c, 1) != OK) exit(42);
+        }
+
+        // the first table is copied, the second one is left to the child by the parent
+        Process *child = system.cloneProcess(parent->getProcessId());
+        if (child == nullptr) exit(42);
+        char z = 'Z';
+        if (child->write(0x00000000, &z, 1) != OK) exit(42);
+        delete parent;
+
+        char r;
+        if (child->read(0x00000000, &r, 1) != OK || r != z) exit(42);
+        if (child->read((segmentSize - 1) * PAGE_SIZE, &r, 1) != OK || r != c) exit(42);
+        delete child;
+
+        // the segment stays with the reader
+        for (PageNum i = 0; i < sharedSize; ++i)
+        {
+            if (reader->read(sharedStart + i * PAGE_SIZE, &r, 1) != OK || r != c) exit(42);
+        }
+    }
+
+    // the last process of a shared segment releases its pages, a new one starts over
+    delete reader;
+    Process *p = system.createProcess();
+    if (p->createSharedSegment(sharedStart, sharedSize, "shared", READ_WRITE) != OK) exit(42);
+    for (PageNum i = 0; i < sharedSize; ++i)
+    {
+        char r;
+        if (p->read(sharedStart + i * PAGE_SIZE, &r, 1) != OK) exit(42);
+    }
+    delete p;
+
+    // pins do not outlive the process, its frames can be evicted again
+    char *smallFrameSpace = new char[4 * FRAME_SIZE];
+    char *smallPmtSpace = new char[8 * FRAME_SIZE];
+    System smallSystem(smallFrameSpace, 4, smallPmtSpace, 8, &swap);
+    Process *pinner = smallSystem.createProcess();
+    if (pinner->createSegment(0x00000000, 4, READ_WRITE) != OK) exit(42);
+    std::vector<Extent> extents;
+    if (pinner->translateRange(0x00000000, 4 * PAGE_SIZE, WRITE, extents) != OK) exit(42);
+    delete pinner;
+    Process *next = smallSystem.createProcess();
+    if (next->createSegment(0x00000000, 8, READ_WRITE) != OK) exit(42);
+    for (PageNum i = 0; i < 8; ++i)
+    {
+        char c = 'n';
+        if (next->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+    std::cout << "OK" << std::endl;
+
+    delete next;
+}
+
+void Test_21()
+{
+    // Pages are pinned and written through their frames by one thread while
+    // another process keeps evicting them. A page pinned while it was being
+    // evicted would be written in a frame that is free or taken by another page.
+    const PageNum segmentSize = 16;
+    const int rounds = 300000;
+    char *frameSpace = new char[8 * FRAME_SIZE];
+    char *pmtSpace = new char[16 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 8, pmtSpace, 16, &swap);
+    Process *pinner = system.createProcess();
+    Process *writer = system.createProcess();
+    if (pinner->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+    if (writer->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+
+    std::atomic<bool> done(false);
+    std::atomic<int> writes(0);
+    std::thread evictor([writer, &done, &writes, segmentSize]()
+    {
+        char c = 'w';
+        for (PageNum i = 0; !done; i = (i + 1) % segmentSize)
+        {
+            if (writer->write(i * PAGE_SIZE, &c, 1) != OK) exit(42);
+            ++writes;
+        }
+    });
+
+    // both threads get to run for a while, also on a single processor
+    for (int round = 0; round < rounds || writes < rounds; ++round)
+    {
+        VirtualAddress address = (round % (segmentSize - 1)) * PAGE_SIZE;
+        char c = 'a' + round % 26;
+        std::vector<Extent> extents;
+        if (pinner->translateRange(address, 2 * PAGE_SIZE - 1, WRITE, extents) != OK) exit(42);
+        for (const Extent &extent : extents)
+        {
+            memset(extent.address_, c, extent.length_);
+        }
+        if (pinner->releaseRange(extents) != OK) exit(42);
+
+        char r;
+        if (pinner->read(address, &r, 1) != OK || r != c) exit(42);
+    }
+    done = true;
+    evictor.join();
+
+    // a process can not unpin the pages of another process
+    std::vector<Extent> extents;
+    if (writer->translateRange(0x00000000, PAGE_SIZE, READ, extents) != OK) exit(42);
+    if (pinner->releaseRange(extents) != TRAP) exit(42);
+    if (writer->releaseRange(extents) != OK) exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete writer;
+    delete pinner;
+}
+
+void Test_22()
+{
+    // A shared segment is deleted over and over while other threads connect
+    // processes to it and let them exit. A process either connects before
+    // the deletion and gets disconnected by it, or is refused.
+    const PageNum segmentSize = 4;
+    const int numThreads = 3;
+    const int rounds = 300;
+    char *frameSpace = new char[32 * FRAME_SIZE];
+    char *pmtSpace = new char[64 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 32, pmtSpace, 64, &swap);
+    Process *owner = system.createProcess();
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.push_back(std::thread([&system, &done, segmentSize]()
+        {
+            while (!done)
+            {
+                Process *p = system.createProcess();
+                if (p == nullptr) exit(42);
+                if (p->createSharedSegment(0x00000000, segmentSize, "shared", READ_WRITE) == OK)
+                {
+                    char c = 'p';
+                    p->write(0x00000000, &c, 1); // fails once the segment is deleted
+                }
+                delete p;
+            }
+        }));
+    }
+
+    for (int round = 0; round < rounds; ++round)
+    {
+        if (owner->createSharedSegment(0x00000000, segmentSize, "shared", READ_WRITE) != OK) exit(42);
+        char c = 'o';
+        if (owner->write(0x00000000, &c, 1) != OK) exit(42);
+        if (owner->deleteSharedSegment("shared") != OK) exit(42);
+        if (system.access(owner->getProcessId(), 0x00000000, READ) != TRAP) exit(42);
+    }
+    done = true;
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    std::cout << "OK" << std::endl;
+
+    delete owner;
+}
+
+void Test_23()
+{
+    Tlb tlb;
+    FrameNum frame;
+
+    // a translation that is inserted after its slot was reserved can be looked up
+    Tlb::Entry stamp = tlb.reserve(5);
+    tlb.insert(5, 7, TLB_BIT_READ | TLB_BIT_REFERENCE, stamp);
+    if (!tlb.lookup(5, TLB_BIT_READ, frame) || frame != 7) exit(42);
+
+    // the page got evicted after its descriptor was read, the stale translation is dropped
+    stamp = tlb.reserve(5);
+    tlb.invalidate(5);
+    tlb.insert(5, 7, TLB_BIT_READ | TLB_BIT_REFERENCE, stamp);
+    if (tlb.lookup(5, TLB_BIT_READ, frame)) exit(42);
+
+    // so is one whose slot got reserved again, by another page that maps to the same slot
+    stamp = tlb.reserve(5);
+    Tlb::Entry other = tlb.reserve(5 + TLB_NUM_ENTRIES);
+    tlb.insert(5, 7, TLB_BIT_READ | TLB_BIT_REFERENCE, stamp);
+    if (tlb.lookup(5, TLB_BIT_READ, frame)) exit(42);
+    tlb.insert(5 + TLB_NUM_ENTRIES, 8, TLB_BIT_READ | TLB_BIT_REFERENCE, other);
+    if (!tlb.lookup(5 + TLB_NUM_ENTRIES, TLB_BIT_READ, frame) || frame != 8) exit(42);
+
+    // a flush drops translations that are about to be inserted too
+    stamp = tlb.reserve(9);
+    tlb.flush();
+    tlb.insert(9, 3, TLB_BIT_READ | TLB_BIT_REFERENCE, stamp);
+    if (tlb.lookup(9, TLB_BIT_READ, frame) || tlb.lookup(5 + TLB_NUM_ENTRIES, TLB_BIT_READ, frame)) exit(42);
+
+    std::cout << "OK" << std::endl;
+}
+
+void Test_24()
+{
+    // A suspended process faults through translateAndResolve() while the
+    // process table grows. Its page faults wait for the system lock, which
+    // is held while a process is created; creating one must not wait for them.
+    char *frameSpace = new char[4 * FRAME_SIZE];
+    char *pmtSpace = new char[300 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 4, pmtSpace, 300, &swap);
+    PhysicalAddress pa;
+    const PageNum segmentSize = 8;
+    Process *running = system.createProcess();
+    Process *suspended = system.createProcess();
+    running->setPriority(1);
+    running->createSegment(0x00000000, segmentSize, READ_WRITE);
+    suspended->createSegment(0x00000000, segmentSize, READ_WRITE);
+
+    // both processes fault on every page, the one with the lower priority gets suspended
+    for (Process *proc : { running, suspended })
+    {
+        for (PageNum page = 0; page < segmentSize; ++page)
+        {
+            if (system.translateAndResolve(proc->getProcessId(), page * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+        }
+    }
+    system.periodicJob();
+    if (!suspended->isSuspended() || running->isSuspended()) exit(42);
+
+    std::atomic<bool> done(false);
+    std::thread faulting([&system, &done, suspended, segmentSize]()
+    {
+        PhysicalAddress pa;
+        for (PageNum page = 0; !done; page = (page + 1) % segmentSize)
+        {
+            if (system.translateAndResolve(suspended->getProcessId(), page * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+        }
+    });
+
+    // the table grows past its initial capacity on the way
+    std::vector<Process *> processes;
+    for (int i = 0; i < 2 * PROCESS_TABLE_INITIAL_CAPACITY; ++i)
+    {
+        Process *proc = system.createProcess();
+        if (proc == nullptr) exit(42);
+        processes.push_back(proc);
+    }
+    done = true;
+    faulting.join();
+
+    for (Process *proc : processes)
+    {
+        delete proc;
+    }
+    delete suspended;
+    delete running;
+    std::cout << "OK" << std::endl;
+}
+
+void Test_25()
+{
+    // Processes translate addresses of a shared segment while it is deleted
+    // and created again. The segment covers one Level 1 PMT completely, the
+    // table is shared, and a few pages of the next one, which is private.
+    // Both are unlinked under the translations; run it with -fsanitize=thread.
+    const PageNum segmentSize = PMT_1_NUM_ENTRIES + 4;
+    const VirtualAddress addresses[] = { 0x00000000, (PMT_1_NUM_ENTRIES + 2) * PAGE_SIZE };
+    const int numThreads = 3;
+    const int rounds = 200;
+    char *frameSpace = new char[32 * FRAME_SIZE];
+    char *pmtSpace = new char[64 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 32, pmtSpace, 64, &swap);
+    Process *owner = system.createProcess();
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.push_back(std::thread([&system, &done, &addresses, segmentSize]()
+        {
+            while (!done)
+            {
+                Process *p = system.createProcess();
+                if (p == nullptr) exit(42);
+                if (p->createSharedSegment(0x00000000, segmentSize, "shared", READ_WRITE) == OK)
+                {
+                    // translations succeed until the segment is deleted
+                    PhysicalAddress pa;
+                    for (int i = 0; !done; i = 1 - i)
+                    {
+                        Status status = system.translateAndResolve(p->getProcessId(), addresses[i], WRITE, pa);
+                        if (status == TRAP) break;
+                        if (status != OK || pa == nullptr) exit(42);
+                    }
+                }
+                delete p;
+            }
+        }));
+    }
+
+    for (int round = 0; round < rounds; ++round)
+    {
+        if (owner->createSharedSegment(0x00000000, segmentSize, "shared", READ_WRITE) != OK) exit(42);
+        for (VirtualAddress address : addresses)
+        {
+            char c = 'o';
+            if (owner->write(address, &c, 1) != OK) exit(42);
+        }
+        if (owner->deleteSharedSegment("shared") != OK) exit(42);
+        PhysicalAddress pa;
+        if (system.translate(owner->getProcessId(), addresses[1], READ, pa) != TRAP) exit(42);
+    }
+    done = true;
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    std::cout << "OK" << std::endl;
+
+    delete owner;
+}
+
+void Test_26()
+{
+    // Far more asynchronous page faults than worker threads are queued, and
+    // the process is deleted before they complete. Every fault is either
+    // serviced or fails, and none of them runs after the process is gone.
+    const PageNum segmentSize = 16;
+    const int numFaults = 256;
+    char *frameSpace = new char[4 * FRAME_SIZE];
+    char *pmtSpace = new char[16 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 4, pmtSpace, 16, &swap);
+    Process *p = system.createProcess();
+    if (p->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+
+    std::vector<std::future<Status>> faults;
+    for (int i = 0; i < numFaults; ++i)
+    {
+        faults.push_back(p->pageFaultAsync((i % segmentSize) * PAGE_SIZE));
+    }
+    delete p;
+
+    for (auto &fault : faults)
+    {
+        if (fault.wait_for(std::chrono::seconds(0)) != std::future_status::ready) exit(42);
+        Status status = fault.get();
+        if (status != OK && status != TRAP) exit(42);
+    }
+    std::cout << "OK" << std::endl;
+}
+
+void Test_27()
+{
+    // A process releases only the pins it took itself, and a release of a
+    // list of extents either takes all of their pins or none of them. The
+    // pages of a shared segment are pinned by both processes connected to it.
+    const PageNum segmentSize = 16;
+    const VirtualAddress segmentStart = 4 * PAGE_SIZE;
+    char *frameSpace = new char[4 * FRAME_SIZE];
+    char *pmtSpace = new char[16 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 4, pmtSpace, 16, &swap);
+    Process *owner = system.createProcess();
+    Process *other = system.createProcess();
+    if (owner->createSharedSegment(0x00000000, 2, "shared", READ_WRITE) != OK) exit(42);
+    if (other->createSharedSegment(0x00000000, 2, "shared", READ_WRITE) != OK) exit(42);
+    if (other->createSegment(segmentStart, segmentSize, READ_WRITE) != OK) exit(42);
+
+    // the other process writes all of its pages, so every page that is not pinned gets evicted
+    std::vector<char> page(PAGE_SIZE, 'o');
+    auto evictAll = [other, &page, segmentStart, segmentSize]()
+    {
+        for (PageNum i = 0; i < 2 * segmentSize; ++i)
+        {
+            if (other->write(segmentStart + (i % segmentSize) * PAGE_SIZE, page.data(), PAGE_SIZE) != OK) exit(42);
+        }
+    };
+    auto isInFrame = [](const Extent &extent, char c)
+    {
+        for (unsigned long i = 0; i < extent.length_; ++i)
+        {
+            if (((char *)extent.address_)[i] != c) return false;
+        }
+        return true;
+    };
+
+    // a list with an invalid extent releases nothing
+    std::vector<Extent> extents;
+    if (owner->translateRange(0x00000000, PAGE_SIZE, WRITE, extents) != OK) exit(42);
+    std::vector<Extent> invalid = extents;
+    invalid.push_back(Extent(frameSpace + 4 * FRAME_SIZE, 1));
+    if (owner->releaseRange(invalid) != TRAP) exit(42);
+    memset(extents[0].address_, 'p', PAGE_SIZE);
+    evictAll();
+    if (!isInFrame(extents[0], 'p')) exit(42);
+
+    // the pin can be released once
+    if (owner->releaseRange(extents) != OK) exit(42);
+    if (owner->releaseRange(extents) != TRAP) exit(42);
+
+    // both processes pin the same frame, a repeated release does not take the pin of the other process
+    std::vector<Extent> mine;
+    std::vector<Extent> theirs;
+    if (owner->translateRange(PAGE_SIZE, PAGE_SIZE, WRITE, mine) != OK) exit(42);
+    if (other->translateRange(PAGE_SIZE, PAGE_SIZE, WRITE, theirs) != OK) exit(42);
+    if (mine[0].address_ != theirs[0].address_) exit(42);
+    if (owner->releaseRange(mine) != OK) exit(42);
+    if (owner->releaseRange(mine) != TRAP) exit(42);
+    memset(theirs[0].address_, 's', PAGE_SIZE);
+    evictAll();
+    if (!isInFrame(theirs[0], 's')) exit(42);
+    if (other->releaseRange(theirs) != OK) exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete other;
+    delete owner;
+}
+
+// A partition that remembers the clusters written to it, in order.
+class RecordingPartition: public Partition {
+public:
+    explicit RecordingPartition(const char *name): Partition(name) {}
+
+    int writeCluster(ClusterNo cluster, const char *buffer) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writes_.push_back(cluster);
+        }
+        return Partition::writeCluster(cluster, buffer);
+    }
+
+    // clusters written since the previous call
+    std::vector<ClusterNo> takeWrites()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<ClusterNo> ret;
+        ret.swap(writes_);
+        return ret;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<ClusterNo> writes_;
+};
+
+void Test_28()
+{
+    // Memory is full of dirty pages of processes below their frame quotas,
+    // so every fault that finds no free frame reclaims a batch. The batch
+    // doubles with each reclaim; its dirty victims are written to a run of
+    // consecutive clusters in ascending order, and the frames not needed
+    // right away serve the next faults. Idle periods halve the batch again.
+    const FrameNum frames = 8;
+    const int numFillers = 4;
+    char *frameSpace = new char[frames * FRAME_SIZE];
+    char *pmtSpace = new char[32 * FRAME_SIZE];
+
+    RecordingPartition swap("p1.ini");
+    System system(frameSpace, frames, pmtSpace, 32, &swap);
+    PhysicalAddress pa;
+    auto isRun = [](const std::vector<ClusterNo> &clusters, std::size_t length)
+    {
+        if (clusters.size() != length) return false;
+        for (std::size_t i = 1; i < clusters.size(); ++i)
+        {
+            if (clusters[i] != clusters[i - 1] + 1) return false;
+        }
+        return true;
+    };
+
+    // two pages each, below the quota of PFF_MIN_QUOTA frames
+    std::vector<Process *> fillers;
+    for (int i = 0; i < numFillers; ++i)
+    {
+        Process *filler = system.createProcess();
+        if (filler->createSegment(0x00000000, 2, READ_WRITE) != OK) exit(42);
+        for (PageNum page = 0; page < 2; ++page)
+        {
+            if (system.translateAndResolve(filler->getProcessId(), page * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+        }
+        fillers.push_back(filler);
+    }
+    system.periodicJob();
+    if (!swap.takeWrites().empty()) exit(42);
+
+    // batches of 1, 2 and 4 frames; the second one leaves a free frame for the third fault
+    Process *p = system.createProcess();
+    if (p->createSegment(0x00000000, PFF_MIN_QUOTA, READ_WRITE) != OK) exit(42);
+    const std::size_t expectedWrites[PFF_MIN_QUOTA] = { 1, 2, 0, 4 };
+    for (PageNum page = 0; page < PFF_MIN_QUOTA; ++page)
+    {
+        if (system.translateAndResolve(p->getProcessId(), page * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+        if (!isRun(swap.takeWrites(), expectedWrites[page])) exit(42);
+    }
+    system.periodicJob();
+
+    // the batch is 8 now, two idle periods bring it down to 2
+    system.periodicJob();
+    system.periodicJob();
+
+    // the three frames left over from the last batch are taken first, then the next batch is reclaimed
+    Process *next = system.createProcess();
+    if (next->createSegment(0x00000000, PFF_MIN_QUOTA, READ_WRITE) != OK) exit(42);
+    for (PageNum page = 0; page < PFF_MIN_QUOTA - 1; ++page)
+    {
+        if (system.translateAndResolve(next->getProcessId(), page * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+    }
+    if (!swap.takeWrites().empty()) exit(42);
+    if (system.translateAndResolve(next->getProcessId(), (PFF_MIN_QUOTA - 1) * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+    if (!isRun(swap.takeWrites(), 2)) exit(42);
+    std::cout << "OK" << std::endl;
+
+    delete next;
+    delete p;
+    for (Process *filler : fillers)
+    {
+        delete filler;
+    }
+}
+
+void Test_29()
+{
+    // Page fault frequency: a process that faults on many pages per period
+    // gains frame quota, and loses it again once it is idle. A process at
+    // its quota replaces its own pages when memory is full.
+    const PageNum segmentSize = 16;
+    const PageNum pagesPerPeriod = 8;
+    char *frameSpace = new char[32 * FRAME_SIZE];
+    char *pmtSpace = new char[32 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 32, pmtSpace, 32, &swap);
+    PhysicalAddress pa;
+    Process *busy = system.createProcess();
+    Process *idle = system.createProcess();
+    if (busy->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+    if (busy->getFrameQuota() != PFF_MIN_QUOTA || idle->getFrameQuota() != PFF_MIN_QUOTA) exit(42);
+
+    // the faults of a period are 200% and then 100% of the quota, above PFF_UPPER_BOUND
+    for (PageNum first = 0; first < segmentSize; first += pagesPerPeriod)
+    {
+        PageNum quota = busy->getFrameQuota();
+        for (PageNum page = first; page < first + pagesPerPeriod; ++page)
+        {
+            if (system.translateAndResolve(busy->getProcessId(), page * PAGE_SIZE, READ, pa) != OK) exit(42);
+        }
+        system.periodicJob();
+        if (busy->getFrameQuota() != quota + PFF_QUOTA_STEP) exit(42);
+        if (idle->getFrameQuota() != PFF_MIN_QUOTA) exit(42);
+    }
+
+    // without faults the quota shrinks step by step, never below PFF_MIN_QUOTA
+    while (busy->getFrameQuota() > PFF_MIN_QUOTA)
+    {
+        PageNum quota = busy->getFrameQuota();
+        system.periodicJob();
+        if (busy->getFrameQuota() != quota - PFF_QUOTA_STEP) exit(42);
+    }
+    system.periodicJob();
+    if (busy->getFrameQuota() != PFF_MIN_QUOTA) exit(42);
+
+    delete idle;
+    delete busy;
+
+    // memory holds the quota of two processes; once it is full, the one at its
+    // quota evicts its own pages and leaves the pages of the other one alone;
+    // the first system never used the swap partition
+    char *smallFrameSpace = new char[2 * PFF_MIN_QUOTA * FRAME_SIZE];
+    char *smallPmtSpace = new char[32 * FRAME_SIZE];
+    System small(smallFrameSpace, 2 * PFF_MIN_QUOTA, smallPmtSpace, 32, &swap);
+    Process *other = small.createProcess();
+    Process *p = small.createProcess();
+    if (other->createSegment(0x00000000, PFF_MIN_QUOTA, READ_WRITE) != OK) exit(42);
+    if (p->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+    for (PageNum page = 0; page < PFF_MIN_QUOTA; ++page)
+    {
+        if (small.translateAndResolve(other->getProcessId(), page * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+    }
+    for (PageNum page = 0; page < segmentSize; ++page)
+    {
+        if (small.translateAndResolve(p->getProcessId(), page * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+        if (p->getResidentSetSize() > PFF_MIN_QUOTA) exit(42);
+        if (other->getResidentSetSize() != PFF_MIN_QUOTA) exit(42);
+    }
+    std::cout << "OK" << std::endl;
+
+    delete p;
+    delete other;
+}
+
+void Test_30()
+{
+    // A read-mostly workload: two dirty pages are read over and over while
+    // clean pages stream through the rest of memory. Page replacement
+    // evicts the clean pages and writes nothing. Once the dirty pages are
+    // left alone they go as well, each written to a cluster of its own.
+    const FrameNum frames = PFF_MIN_QUOTA;
+    const PageNum dirtyPages = 2;
+    const PageNum segmentSize = 32;
+    char *frameSpace = new char[frames * FRAME_SIZE];
+    char *pmtSpace = new char[16 * FRAME_SIZE];
+
+    RecordingPartition swap("p1.ini");
+    System system(frameSpace, frames, pmtSpace, 16, &swap);
+    Process *p = system.createProcess();
+    if (p->createSegment(0x00000000, segmentSize, READ_WRITE) != OK) exit(42);
+    ProcessId pid = p->getProcessId();
+    PhysicalAddress pa;
+
+    for (PageNum page = 0; page < dirtyPages; ++page)
+    {
+        char c = 'd' + page;
+        if (p->write(page * PAGE_SIZE, &c, 1) != OK) exit(42);
+    }
+
+    // the dirty pages are referenced before every fault on a clean page
+    PageNum page = dirtyPages;
+    for (; page < segmentSize / 2; ++page)
+    {
+        for (PageNum dirty = 0; dirty < dirtyPages; ++dirty)
+        {
+            if (system.translateAndResolve(pid, dirty * PAGE_SIZE, READ, pa) != OK) exit(42);
+        }
+        if (system.translateAndResolve(pid, page * PAGE_SIZE, READ, pa) != OK) exit(42);
+    }
+    if (!swap.takeWrites().empty()) exit(42);
+    for (PageNum dirty = 0; dirty < dirtyPages; ++dirty)
+    {
+        if (system.translate(pid, dirty * PAGE_SIZE, READ, pa) != OK) exit(42);
+    }
+
+    // only the clean pages are referenced now
+    for (; page < segmentSize; ++page)
+    {
+        if (system.translateAndResolve(pid, page * PAGE_SIZE, READ, pa) != OK) exit(42);
+    }
+    std::vector<ClusterNo> writes = swap.takeWrites();
+    if (writes.size() != dirtyPages || writes[0] == writes[1]) exit(42);
+    for (PageNum dirty = 0; dirty < dirtyPages; ++dirty)
+    {
+        char c;
+        if (system.access(pid, dirty * PAGE_SIZE, READ) != PAGE_FAULT) exit(42);
+        if (p->read(dirty * PAGE_SIZE, &c, 1) != OK || c != (char)('d' + dirty)) exit(42);
+    }
+    std::cout << "OK" << std::endl;
+
+    delete p;
+}
+
+void Test_31()
+{
+    // A clean shared page is evicted by a fault on a private page of one of
+    // the processes that share it. The page has a single state, so it is
+    // unmapped for all of them, none keeps a stale translation, and the
+    // page read in again by one is the page the others see.
+    const int numSharers = 3;
+    char *frameSpace = new char[2 * FRAME_SIZE];
+    char *pmtSpace = new char[32 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 2, pmtSpace, 32, &swap);
+    PhysicalAddress pa;
+    Process *sharers[numSharers];
+    for (int i = 0; i < numSharers; ++i)
+    {
+        sharers[i] = system.createProcess();
+        if (sharers[i]->createSharedSegment(0x00000000, 1, "shared", READ_WRITE) != OK) exit(42);
+    }
+    for (int i = 0; i < numSharers; ++i)
+    {
+        if (system.translateAndResolve(sharers[i]->getProcessId(), 0x00000000, READ, pa) != OK) exit(42);
+        if (system.translate(sharers[i]->getProcessId(), 0x00000000, READ, pa) != OK) exit(42); // cached in the TLB
+    }
+
+    // the private pages are dirty, the shared page is the clean victim
+    Process *evictor = sharers[0];
+    if (evictor->createSegment(PAGE_SIZE, 2, READ_WRITE) != OK) exit(42);
+    for (PageNum page = 1; page <= 2; ++page)
+    {
+        if (system.translateAndResolve(evictor->getProcessId(), page * PAGE_SIZE, WRITE, pa) != OK) exit(42);
+    }
+
+    for (int i = 0; i < numSharers; ++i)
+    {
+        if (system.access(sharers[i]->getProcessId(), 0x00000000, READ) != PAGE_FAULT) exit(42);
+        if (system.translate(sharers[i]->getProcessId(), 0x00000000, READ, pa) != PAGE_FAULT) exit(42);
+    }
+
+    char c = 's';
+    if (sharers[numSharers - 1]->write(0x00000000, &c, 1) != OK) exit(42);
+    for (int i = 0; i < numSharers; ++i)
+    {
+        if (sharers[i]->read(0x00000000, &c, 1) != OK || c != 's') exit(42);
+    }
+    std::cout << "OK" << std::endl;
+
+    for (int i = 0; i < numSharers; ++i)
+    {
+        delete sharers[i];
+    }
+}
+
+void Test_32()
+{
+    // Threads of one process write their own pages while their faults
+    // evict the pages of the other threads, so the dirty bits are set by
+    // translate() while page replacement clears the other bits of the same
+    // flags. A lost dirty bit would drop a write when the page is evicted.
+    const int numThreads = 4;
+    const PageNum pagesPerThread = 4;
+    const unsigned int rounds = 2000;
+    char *frameSpace = new char[8 * FRAME_SIZE];
+    char *pmtSpace = new char[16 * FRAME_SIZE];
+
+    Partition swap("p1.ini");
+    System system(frameSpace, 8, pmtSpace, 16, &swap);
+    Process *p = system.createProcess();
+    if (p->createSegment(0x00000000, numThreads * pagesPerThread, READ_WRITE) != OK) exit(42);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.push_back(std::thread([p, t, pagesPerThread, rounds]()
+        {
+            for (unsigned int round = 1; round <= rounds; ++round)
+            {
+                VirtualAddress address = (t * pagesPerThread + round % pagesPerThread) * PAGE_SIZE;
+                if (p->write(address, &round, sizeof(round)) != OK) exit(42);
+            }
+        }));
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    // the last round wrote the last pages and the rounds before it the others
+    for (int t = 0; t < numThreads; ++t)
+    {
+        for (PageNum i = 0; i < pagesPerThread; ++i)
+        {
+            unsigned int expected = rounds - (rounds - i) % pagesPerThread;
+            unsigned int value;
+            if (p->read((t * pagesPerThread + i) * PAGE_SIZE, &value, sizeof(value)) != OK) exit(42);
+            if (value != expected) exit(42);
+        }
+    }
+    std::cout << "OK" << std::endl;
+
+    delete p;
+}
@@ -4,7 +4,6 @@
 #ifndef VM_EMU_TESTS_H
 #define VM_EMU_TESTS_H
 
-void testDescriptorSize();
 void testFrameAllocation();
 void testSegmentAllocation();
 void Test_01();
@@ -13,6 +12,32 @@ void Test_03();
 void Test_04();
 void Test_05();
 void Test_06();
+void Test_07();
+void Test_08();
+void Test_09();
+void Test_10();
+void Test_11();
+void Test_12();
+void Test_13();
+void Test_14();
+void Test_15();
+void Test_16();
+void Test_17();
+void Test_18();
+void Test_19();
+void Test_20();
+void Test_21();
+void Test_22();
+void Test_23();
+void Test_24();
+void Test_25();
+void Test_26();
+void Test_27();
+void Test_28();
+void Test_29();
+void Test_30();
+void Test_31();
+void Test_32();
 
 #endif // VM_EMU_TESTS_H
 